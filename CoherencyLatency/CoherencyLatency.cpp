@@ -10,24 +10,23 @@ float RunTest(unsigned int processor1, unsigned int processor2, uint64_t iter);
 float RunOwnedTest(unsigned int processor1, unsigned int processor2, uint64_t iter);
 DWORD WINAPI LatencyTestThread(LPVOID param);
 DWORD WINAPI ReadLatencyTestThread(LPVOID param);
+BOOL SetThreadProcessor(HANDLE thread, unsigned int processor);
 
 typedef struct LatencyThreadData {
     uint64_t start;       // initial value to write into target
     uint64_t iterations;  // number of iterations to run
     LONG64 *target;       // value to bounce between threads, init with start - 1
     LONG64 *readTarget;   // for read test, memory location to read from (owned by other core)
-    DWORD affinityMask;   // thread affinity mask to set
 } LatencyData;
 
 int main(int argc, char *argv[]) {
-    SYSTEM_INFO sysInfo;
     DWORD numProcs;
     float* latencies;
     uint64_t iter = ITERATIONS;
     float (*test)(unsigned int, unsigned int, uint64_t) = RunTest;
 
-    GetSystemInfo(&sysInfo);
-    numProcs = sysInfo.dwNumberOfProcessors;
+    // dwNumberOfProcessors from GetSystemInfo only covers the current processor group (max 64)
+    numProcs = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
     fprintf(stderr, "Number of CPUs: %u\n", numProcs);
     latencies = (float *)malloc(sizeof(float) * numProcs * numProcs);
     if (latencies == NULL) {
@@ -85,8 +84,9 @@ float TimeThreads(unsigned int processor1, unsigned int processor2, uint64_t ite
         return -1;
     }
 
-    SetThreadAffinityMask(testThreads[0], 1ULL << (uint64_t)processor1);
-    SetThreadAffinityMask(testThreads[1], 1ULL << (uint64_t)processor2);
+    if (!SetThreadProcessor(testThreads[0], processor1) || !SetThreadProcessor(testThreads[1], processor2)) {
+        fprintf(stderr, "Failed to set thread affinity\n");
+    }
 
     ftime(&start);
     ResumeThread(testThreads[0]);
@@ -106,6 +106,31 @@ float TimeThreads(unsigned int processor1, unsigned int processor2, uint64_t ite
     return latency / 2;
 }
 
+/// <summary>
+/// Pins a thread to one logical processor. Processors are numbered across all processor
+/// groups, since an affinity mask only covers 64 processors in one group
+/// </summary>
+/// <param name="thread">thread to pin</param>
+/// <param name="processor">processor number, counting up through each group</param>
+/// <returns>TRUE on success</returns>
+BOOL SetThreadProcessor(HANDLE thread, unsigned int processor) {
+    GROUP_AFFINITY affinity;
+    WORD groupCount = GetActiveProcessorGroupCount();
+    for (WORD group = 0; group < groupCount; group++) {
+        DWORD groupProcs = GetActiveProcessorCount(group);
+        if (processor < groupProcs) {
+            memset(&affinity, 0, sizeof(GROUP_AFFINITY));
+            affinity.Group = group;
+            affinity.Mask = (KAFFINITY)1 << processor;
+            return SetThreadGroupAffinity(thread, &affinity, NULL);
+        }
+
+        processor -= groupProcs;
+    }
+
+    return FALSE;
+}
+
 /// <summary>
 /// Measures latency from one processor core to another
 /// </summary>
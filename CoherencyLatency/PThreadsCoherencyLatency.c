@@ -3,51 +3,1117 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <ctype.h>
 #include <sys/sysinfo.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 #include <sched.h>
 #include <pthread.h>
+#include <math.h>
+#include <linux/futex.h>
+
+#ifdef __aarch64__
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#ifdef __x86_64
+#include <cpuid.h>
+#endif
 
 #define ITERATIONS 10000000;
 
+// contention test threads run for this long at each thread count
+#define CONTENTION_TEST_MS 200
+
+// spacing between the lines in the multi-line contention test, so adjacent line prefetch doesn't pair them up
+#define CONTENTION_LINE_BYTES 128
+
+// pairs re-run one at a time to check how much concurrent pairs disturbed each other
+#define VALIDATION_SAMPLES 16
+
+// consecutive merge latencies this far apart mark a new topology level
+#define TOPOLOGY_GAP_RATIO 1.25f
+#define TOPOLOGY_MIN_GAP_NS 2.0f
+
 // kidding right?
 #define gettid() syscall(SYS_gettid)
 
 typedef struct LatencyThreadData {
-    uint64_t start;
-    uint64_t iterations;
-    uint64_t *target;
+    uint64_t start;       // initial value to write into target
+    uint64_t iterations;  // number of iterations to run
+    uint64_t *target;     // value to bounce between threads, init with start - 1
+    uint64_t *readTarget; // for owned test, memory location to read from (owned by other core)
     unsigned int processorIndex;
+    uint64_t firstNs;     // set by the thread when it completes its first handoff
+    uint64_t endNs;       // set by the thread when it completes its last handoff
 } LatencyData;
 
-void *LatencyTestThread(void *param);
-float RunTest(unsigned int processor1, unsigned int processor2, uint64_t iter); 
+// anything the pinned workers run, given per-worker data
+typedef void (*WorkerFunc)(void *);
+
+typedef struct ContentionThreadData {
+    uint64_t *target;
+    uint64_t durationNs;
+    uint64_t ops;         // written by the thread
+    uint64_t elapsedNs;   // written by the thread
+} __attribute__((aligned(64))) ContentionThreadData;
+
+// implementations of a test that can be picked at runtime, like which CAS the bounce test uses
+typedef struct TestVariant {
+    const char *name;
+    WorkerFunc threadFunc;
+    int (*supported)();
+} TestVariant;
+
+// an atomic op at one memory order, for the atomics matrix
+typedef struct AtomicVariant {
+    const char *op;
+    const char *order;
+    WorkerFunc bounceFunc;        // hands a line back and forth with another CPU
+    WorkerFunc uncontendedFunc;   // same op on a line nobody else touches
+    int (*supported)();
+} AtomicVariant;
+
+// both sides of a test between two CPUs
+typedef struct PairTest {
+    LatencyData lat1, lat2;
+    uint64_t *buffer;
+} PairTest;
+
+struct CorePool;
+
+// one per CPU, pinned there for the whole run
+typedef struct CoreWorker {
+    pthread_t handle;
+    unsigned int processor;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;      // signaled when a test is assigned or the pool is shutting down
+    WorkerFunc func;          // test to run, NULL when idle
+    void *jobData;
+    int assigned;             // given a test since the last run
+    struct CorePool *pool;
+} CoreWorker;
+
+typedef struct CorePool {
+    unsigned int workerCount;
+    CoreWorker *workers;
+    int assigned;             // workers given a test since the last run
+    int ready;                // assigned workers spinning on go
+    int go;                   // set once every assigned worker is ready
+    int finished;
+    int quit;
+    pthread_mutex_t lock;
+    pthread_cond_t doneCond;
+} CorePool;
+
+void LatencyTestThread(void *param);
+void ReadLatencyTestThread(void *param);
+float RunTest(CorePool *pool, unsigned int processor1, unsigned int processor2, uint64_t iter, WorkerFunc threadFunc);
+float RunOwnedTest(CorePool *pool, unsigned int processor1, unsigned int processor2, uint64_t iter, WorkerFunc threadFunc);
+void SetupPairTest(PairTest *test, unsigned int processor1, unsigned int processor2, uint64_t iter, int owned);
+float FinishPairTest(PairTest *test);
+void AssignWorker(CorePool *pool, unsigned int processor, WorkerFunc func, void *jobData);
+void AssignPairTest(CorePool *pool, PairTest *test, WorkerFunc threadFunc);
+void RunAssignedTests(CorePool *pool);
+int CreateCorePool(CorePool *pool, unsigned int workerCount);
+void DestroyCorePool(CorePool *pool);
+void RunContentionTest(CorePool *pool, int *cpus, int cpuCount, TestVariant *op, int lineCount);
+void RunQueueTest(CorePool *pool, int numProcs, uint64_t messages);
+int GetPlacementClass(int cpu1, int cpu2);
+void RunAtomicsTest(CorePool *pool, int numProcs, uint64_t iter);
+void RunMesiTest(CorePool *pool, int numProcs, uint64_t rounds, int scenario, int maxSharers);
+void InferTopology(float *latencies, int numProcs);
+void RunOneWayTest(CorePool *pool, int numProcs, uint64_t samples);
+void RunLockTest(CorePool *pool, TestVariant *locks, int lockCount, int *cpus, int cpuCount, uint64_t csWork, uint64_t outsideWork, int readPercent);
+TestVariant *FindVariant(TestVariant *variants, int count, const char *name);
+int *ParseCpuList(char *list, int numProcs, int *cpuCount);
+void RunConcurrentMatrix(CorePool *pool, int numProcs, uint64_t iter, int owned, WorkerFunc threadFunc, float *latencies);
+int SetCurrentThreadAffinity(unsigned int processor);
+
+static inline uint64_t GetNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return 1000000000ULL * ts.tv_sec + ts.tv_nsec;
+}
+
+// raw timestamp counter (TSC on x86, virtual counter on aarch64), ordered after earlier loads
+static inline uint64_t ReadTimestamp() {
+#ifdef __x86_64
+    uint32_t lo, hi;
+    __asm__ __volatile__("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ __volatile__("isb\n\tmrs %0, cntvct_el0" : "=r"(ticks) : : "memory");
+    return ticks;
+#else
+    return GetNs();
+#endif
+}
+
+static inline int CasAtomic(uint64_t *target, uint64_t expected, uint64_t desired) {
+    return __atomic_compare_exchange_n(target, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+int AlwaysSupported() { return 1; }
+
+#ifdef __x86_64
+static inline int CasLockCmpxchg(uint64_t *target, uint64_t expected, uint64_t desired) {
+    uint8_t success;
+    __asm__ __volatile__("lock cmpxchgq %3, %1\n\tsete %0"
+                         : "=q"(success), "+m"(*target), "+a"(expected)
+                         : "r"(desired)
+                         : "memory", "cc");
+    return success;
+}
+#endif
+
+#ifdef __aarch64__
+// load/store exclusive. gives up if the value doesn't match, like a real CAS would
+static inline int CasLlsc(uint64_t *target, uint64_t expected, uint64_t desired) {
+    uint64_t old;
+    uint32_t failed;
+    __asm__ __volatile__("1: ldaxr %0, [%2]\n\t"
+                         "cmp %0, %3\n\t"
+                         "b.ne 2f\n\t"
+                         "stlxr %w1, %4, [%2]\n\t"
+                         "cbnz %w1, 1b\n\t"
+                         "2:"
+                         : "=&r"(old), "=&r"(failed)
+                         : "r"(target), "r"(expected), "r"(desired)
+                         : "memory", "cc");
+    return old == expected;
+}
+
+static inline int CasLse(uint64_t *target, uint64_t expected, uint64_t desired) {
+    uint64_t old = expected;
+    __asm__ __volatile__(".arch_extension lse\n\t"
+                         "casal %0, %2, [%1]"
+                         : "+r"(old)
+                         : "r"(target), "r"(desired)
+                         : "memory");
+    return old == expected;
+}
+
+int LseSupported() { return (getauxval(AT_HWCAP) & HWCAP_ATOMICS) != 0; }
+#endif
+
+// one bounce thread function per CAS flavor, so the CAS gets inlined into the loop.
+// timing starts at the thread's first successful CAS, so only the bounces get counted
+#define CAS_LATENCY_THREAD(name, casFunc)                                                   \
+    void name(void *param) {                                                                \
+        LatencyData *latencyData = (LatencyData *)param;                                    \
+        uint64_t current = latencyData->start;                                              \
+        while (!casFunc(latencyData->target, current - 1, current));                        \
+        latencyData->firstNs = GetNs();                                                     \
+        current += 2;                                                                       \
+        while (current <= 2 * latencyData->iterations) {                                    \
+            if (casFunc(latencyData->target, current - 1, current)) current += 2;           \
+        }                                                                                   \
+        latencyData->endNs = GetNs();                                                       \
+    }
+
+CAS_LATENCY_THREAD(LatencyTestThread, CasAtomic)
+#ifdef __x86_64
+CAS_LATENCY_THREAD(LockCmpxchgLatencyTestThread, CasLockCmpxchg)
+#endif
+#ifdef __aarch64__
+CAS_LATENCY_THREAD(LlscLatencyTestThread, CasLlsc)
+CAS_LATENCY_THREAD(LseLatencyTestThread, CasLse)
+#endif
+
+TestVariant casVariants[] = {
+    { "atomic", LatencyTestThread, AlwaysSupported },
+#ifdef __x86_64
+    { "lockcmpxchg", LockCmpxchgLatencyTestThread, AlwaysSupported },
+#endif
+#ifdef __aarch64__
+    { "llsc", LlscLatencyTestThread, AlwaysSupported },
+    { "lse", LseLatencyTestThread, LseSupported },
+#endif
+};
+
+static inline void AddAtomic(uint64_t *target) {
+    __atomic_fetch_add(target, 1, __ATOMIC_SEQ_CST);
+}
+
+#ifdef __x86_64
+static inline void AddLockXadd(uint64_t *target) {
+    uint64_t one = 1;
+    __asm__ __volatile__("lock xaddq %0, %1" : "+r"(one), "+m"(*target) : : "memory", "cc");
+}
+
+static inline void AddCmpxchg(uint64_t *target) {
+    uint64_t old = __atomic_load_n(target, __ATOMIC_RELAXED);
+    while (!CasLockCmpxchg(target, old, old + 1)) old = __atomic_load_n(target, __ATOMIC_RELAXED);
+}
+#endif
+
+#ifdef __aarch64__
+static inline void AddLlsc(uint64_t *target) {
+    uint64_t value;
+    uint32_t failed;
+    __asm__ __volatile__("1: ldaxr %0, [%2]\n\t"
+                         "add %0, %0, 1\n\t"
+                         "stlxr %w1, %0, [%2]\n\t"
+                         "cbnz %w1, 1b"
+                         : "=&r"(value), "=&r"(failed)
+                         : "r"(target)
+                         : "memory");
+}
+
+static inline void AddLdadd(uint64_t *target) {
+    uint64_t old;
+    __asm__ __volatile__(".arch_extension lse\n\t"
+                         "ldaddal %1, %0, [%2]"
+                         : "=r"(old)
+                         : "r"(1ULL), "r"(target)
+                         : "memory");
+}
+#endif
+
+// increments the target as fast as possible until the test duration's up. checking the
+// time every 64 ops keeps clock_gettime from showing up at low thread counts
+#define CONTENTION_THREAD(name, addFunc)                                                    \
+    void name(void *param) {                                                                \
+        ContentionThreadData *contentionData = (ContentionThreadData *)param;               \
+        uint64_t ops = 0, startNs = GetNs(), nowNs = startNs;                               \
+        while (nowNs - startNs < contentionData->durationNs) {                              \
+            for (int i = 0; i < 64; i++) addFunc(contentionData->target);                   \
+            ops += 64;                                                                      \
+            nowNs = GetNs();                                                                \
+        }                                                                                   \
+        contentionData->ops = ops;                                                          \
+        contentionData->elapsedNs = nowNs - startNs;                                        \
+    }
+
+CONTENTION_THREAD(AtomicContentionThread, AddAtomic)
+#ifdef __x86_64
+CONTENTION_THREAD(LockXaddContentionThread, AddLockXadd)
+CONTENTION_THREAD(CmpxchgContentionThread, AddCmpxchg)
+#endif
+#ifdef __aarch64__
+CONTENTION_THREAD(LlscContentionThread, AddLlsc)
+CONTENTION_THREAD(LdaddContentionThread, AddLdadd)
+#endif
+
+TestVariant contentionOps[] = {
+    { "atomic", AtomicContentionThread, AlwaysSupported },
+#ifdef __x86_64
+    { "xadd", LockXaddContentionThread, AlwaysSupported },
+    { "cmpxchg", CmpxchgContentionThread, AlwaysSupported },
+#endif
+#ifdef __aarch64__
+    { "llsc", LlscContentionThread, AlwaysSupported },
+    { "ldadd", LdaddContentionThread, LseSupported },
+#endif
+};
+
+// memory orders for the atomics matrix, as rmw, store, load
+#define ORDERS_SEQ_CST __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST
+#define ORDERS_ACQ_REL __ATOMIC_ACQ_REL, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE
+#define ORDERS_RELAXED __ATOMIC_RELAXED, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+
+// each handoff waits (polling with a plain load) until the other side has published current - 1,
+// then publishes current with the operation under test. with only one thread, the wait falls
+// straight through, which gives the uncontended cost. always_inline so the orders end up constant.
+// every handoff takes all three orders so they fit the same template, and ignores the ones it doesn't use
+#define HANDOFF_FUNC static inline __attribute__((always_inline)) void
+
+HANDOFF_FUNC CasHandoff(uint64_t *target, uint64_t current, int rmwOrder, int storeOrder, int loadOrder) {
+    uint64_t expected = current - 1;
+    (void)storeOrder;
+    while (__atomic_load_n(target, loadOrder) != current - 1);
+    __atomic_compare_exchange_n(target, &expected, current, 0, rmwOrder, loadOrder);
+}
+
+HANDOFF_FUNC XchgHandoff(uint64_t *target, uint64_t current, int rmwOrder, int storeOrder, int loadOrder) {
+    (void)storeOrder;
+    while (__atomic_load_n(target, loadOrder) != current - 1);
+    __atomic_exchange_n(target, current, rmwOrder);
+}
+
+HANDOFF_FUNC XaddHandoff(uint64_t *target, uint64_t current, int rmwOrder, int storeOrder, int loadOrder) {
+    (void)storeOrder;
+    while (__atomic_load_n(target, loadOrder) != current - 1);
+    __atomic_fetch_add(target, 1, rmwOrder);
+}
+
+// or can't count, so only the low bit goes back and forth. odd handoffs set it with or,
+// and even ones clear it with and (same instruction class, lock and/ldclr)
+HANDOFF_FUNC OrHandoff(uint64_t *target, uint64_t current, int rmwOrder, int storeOrder, int loadOrder) {
+    (void)storeOrder;
+    while ((__atomic_load_n(target, loadOrder) & 1) == (current & 1));
+    if (current & 1) __atomic_fetch_or(target, 1, rmwOrder);
+    else __atomic_fetch_and(target, ~1ULL, rmwOrder);
+}
+
+HANDOFF_FUNC StoreHandoff(uint64_t *target, uint64_t current, int rmwOrder, int storeOrder, int loadOrder) {
+    (void)rmwOrder;
+    while (__atomic_load_n(target, loadOrder) != current - 1);
+    __atomic_store_n(target, current, storeOrder);
+}
+
+// 16 byte CAS with both halves holding the same value. target has to be 16B aligned
+#ifdef __x86_64
+HANDOFF_FUNC Cas16Handoff(uint64_t *target, uint64_t current, int rmwOrder, int storeOrder, int loadOrder) {
+    uint64_t lo = current - 1, hi = current - 1;
+    (void)rmwOrder; // lock cmpxchg16b is always a full barrier
+    (void)storeOrder;
+    while (__atomic_load_n(target, loadOrder) != current - 1);
+    __asm__ __volatile__("lock cmpxchg16b %0"
+                         : "+m"(*(unsigned __int128 *)target), "+a"(lo), "+d"(hi)
+                         : "b"(current), "c"(current)
+                         : "memory", "cc");
+}
+
+int Cas16Supported() {
+    uint32_t cpuidEax, cpuidEbx, cpuidEcx, cpuidEdx;
+    __cpuid(1, cpuidEax, cpuidEbx, cpuidEcx, cpuidEdx);
+    return (cpuidEcx & (1UL << 13)) != 0;
+}
+#endif
+
+#ifdef __aarch64__
+HANDOFF_FUNC Cas16Handoff(uint64_t *target, uint64_t current, int rmwOrder, int storeOrder, int loadOrder) {
+    // casp wants even/odd register pairs
+    register uint64_t x0 __asm__("x0") = current - 1, x1 __asm__("x1") = current - 1;
+    register uint64_t x2 __asm__("x2") = current, x3 __asm__("x3") = current;
+    (void)rmwOrder; // always caspal
+    (void)storeOrder;
+    while (__atomic_load_n(target, loadOrder) != current - 1);
+    __asm__ __volatile__(".arch_extension lse\n\t"
+                         "caspal x0, x1, x2, x3, [%4]"
+                         : "+r"(x0), "+r"(x1)
+                         : "r"(x2), "r"(x3), "r"(target)
+                         : "memory");
+}
+
+#define Cas16Supported LseSupported
+#endif
+
+// bounce thread works like the CAS ones. the uncontended thread does every handoff itself
+#define ATOMIC_TEST_THREADS(op, order, orders)                                              \
+    void op##order##BounceThread(void *param) {                                             \
+        LatencyData *latencyData = (LatencyData *)param;                                    \
+        uint64_t current = latencyData->start;                                              \
+        op##Handoff(latencyData->target, current, orders);                                  \
+        latencyData->firstNs = GetNs();                                                     \
+        for (current += 2; current <= 2 * latencyData->iterations; current += 2)            \
+            op##Handoff(latencyData->target, current, orders);                              \
+        latencyData->endNs = GetNs();                                                       \
+    }                                                                                       \
+    void op##order##UncontendedThread(void *param) {                                        \
+        LatencyData *latencyData = (LatencyData *)param;                                    \
+        latencyData->firstNs = GetNs();                                                     \
+        for (uint64_t current = 1; current <= latencyData->iterations; current++)           \
+            op##Handoff(latencyData->target, current, orders);                              \
+        latencyData->endNs = GetNs();                                                       \
+    }
+
+ATOMIC_TEST_THREADS(Cas, SeqCst, ORDERS_SEQ_CST)
+ATOMIC_TEST_THREADS(Cas, AcqRel, ORDERS_ACQ_REL)
+ATOMIC_TEST_THREADS(Cas, Relaxed, ORDERS_RELAXED)
+ATOMIC_TEST_THREADS(Xchg, SeqCst, ORDERS_SEQ_CST)
+ATOMIC_TEST_THREADS(Xchg, AcqRel, ORDERS_ACQ_REL)
+ATOMIC_TEST_THREADS(Xchg, Relaxed, ORDERS_RELAXED)
+ATOMIC_TEST_THREADS(Xadd, SeqCst, ORDERS_SEQ_CST)
+ATOMIC_TEST_THREADS(Xadd, AcqRel, ORDERS_ACQ_REL)
+ATOMIC_TEST_THREADS(Xadd, Relaxed, ORDERS_RELAXED)
+ATOMIC_TEST_THREADS(Or, SeqCst, ORDERS_SEQ_CST)
+ATOMIC_TEST_THREADS(Or, AcqRel, ORDERS_ACQ_REL)
+ATOMIC_TEST_THREADS(Or, Relaxed, ORDERS_RELAXED)
+ATOMIC_TEST_THREADS(Store, SeqCst, ORDERS_SEQ_CST)
+ATOMIC_TEST_THREADS(Store, AcqRel, ORDERS_ACQ_REL)
+ATOMIC_TEST_THREADS(Store, Relaxed, ORDERS_RELAXED)
+#if defined(__x86_64) || defined(__aarch64__)
+ATOMIC_TEST_THREADS(Cas16, SeqCst, ORDERS_SEQ_CST)
+#endif
+
+AtomicVariant atomicVariants[] = {
+    { "cas", "seq_cst", CasSeqCstBounceThread, CasSeqCstUncontendedThread, AlwaysSupported },
+    { "cas", "acq_rel", CasAcqRelBounceThread, CasAcqRelUncontendedThread, AlwaysSupported },
+    { "cas", "relaxed", CasRelaxedBounceThread, CasRelaxedUncontendedThread, AlwaysSupported },
+    { "xchg", "seq_cst", XchgSeqCstBounceThread, XchgSeqCstUncontendedThread, AlwaysSupported },
+    { "xchg", "acq_rel", XchgAcqRelBounceThread, XchgAcqRelUncontendedThread, AlwaysSupported },
+    { "xchg", "relaxed", XchgRelaxedBounceThread, XchgRelaxedUncontendedThread, AlwaysSupported },
+    { "xadd", "seq_cst", XaddSeqCstBounceThread, XaddSeqCstUncontendedThread, AlwaysSupported },
+    { "xadd", "acq_rel", XaddAcqRelBounceThread, XaddAcqRelUncontendedThread, AlwaysSupported },
+    { "xadd", "relaxed", XaddRelaxedBounceThread, XaddRelaxedUncontendedThread, AlwaysSupported },
+    { "or", "seq_cst", OrSeqCstBounceThread, OrSeqCstUncontendedThread, AlwaysSupported },
+    { "or", "acq_rel", OrAcqRelBounceThread, OrAcqRelUncontendedThread, AlwaysSupported },
+    { "or", "relaxed", OrRelaxedBounceThread, OrRelaxedUncontendedThread, AlwaysSupported },
+    { "store/load", "seq_cst", StoreSeqCstBounceThread, StoreSeqCstUncontendedThread, AlwaysSupported },
+    { "store/load", "rel/acq", StoreAcqRelBounceThread, StoreAcqRelUncontendedThread, AlwaysSupported },
+    { "store/load", "relaxed", StoreRelaxedBounceThread, StoreRelaxedUncontendedThread, AlwaysSupported },
+#if defined(__x86_64) || defined(__aarch64__)
+    { "cas16", "seq_cst", Cas16SeqCstBounceThread, Cas16SeqCstUncontendedThread, Cas16Supported },
+#endif
+};
+
+// spin loop hint
+static inline void CpuRelax() {
+#if defined(__x86_64) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+// stand-in for work inside or outside the critical section. each iteration is one dependent add
+static inline void DoWork(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) __asm__ __volatile__("" ::: "memory");
+}
+
+// queue lock node, one per thread for MCS, recycled between threads for CLH
+typedef struct LockNode {
+    struct LockNode *next;
+    int locked;
+} __attribute__((aligned(64))) LockNode;
+
+// every lock under test, each on its own line, plus the data they protect
+typedef struct LockBenchmark {
+    int tasFlag __attribute__((aligned(64)));
+    uint32_t ticketNext __attribute__((aligned(64)));
+    uint32_t ticketServing __attribute__((aligned(64)));
+    LockNode *mcsTail __attribute__((aligned(64)));
+    LockNode *clhTail __attribute__((aligned(64)));
+    int futexWord __attribute__((aligned(64)));
+    pthread_mutex_t mutex __attribute__((aligned(64)));
+    pthread_rwlock_t rwlock __attribute__((aligned(64)));
+
+    // protected by the lock under test
+    uint64_t counter __attribute__((aligned(64)));
+    int lastOwner;
+    uint64_t lastReleaseNs;
+
+    uint64_t csWork;
+    uint64_t outsideWork;
+    uint64_t durationNs;
+    int readPercent;        // rwlock-read: share of acquisitions that take the read lock
+} LockBenchmark;
+
+typedef struct LockThreadData {
+    LockBenchmark *bench;
+    int threadIdx;
+    LockNode *node;         // MCS: this thread's node. CLH: the node this thread enqueues next
+    LockNode *pred;         // CLH: predecessor's node, which this thread takes over on release
+    uint64_t acquisitions;  // written by the thread
+    uint64_t handoffs;      // acquisitions right after a different thread released
+    uint64_t handoffNs;     // total time from those releases to this thread acquiring
+    uint64_t elapsedNs;
+} __attribute__((aligned(64))) LockThreadData;
+
+static inline void TasAcquire(LockBenchmark *bench, LockThreadData *threadData) {
+    (void)threadData;
+    while (__atomic_exchange_n(&bench->tasFlag, 1, __ATOMIC_ACQUIRE)) CpuRelax();
+}
+
+static inline void TasRelease(LockBenchmark *bench, LockThreadData *threadData) {
+    (void)threadData;
+    __atomic_store_n(&bench->tasFlag, 0, __ATOMIC_RELEASE);
+}
+
+#define TTAS_MAX_BACKOFF 1024
+
+// spin on a plain load so waiters share the line, and back off exponentially after losing a race
+static inline void TtasAcquire(LockBenchmark *bench, LockThreadData *threadData) {
+    uint32_t backoff = 1;
+    (void)threadData;
+    while (1) {
+        while (__atomic_load_n(&bench->tasFlag, __ATOMIC_RELAXED)) CpuRelax();
+        if (!__atomic_exchange_n(&bench->tasFlag, 1, __ATOMIC_ACQUIRE)) return;
+        for (uint32_t i = 0; i < backoff; i++) CpuRelax();
+        if (backoff < TTAS_MAX_BACKOFF) backoff *= 2;
+    }
+}
+
+static inline void TicketAcquire(LockBenchmark *bench, LockThreadData *threadData) {
+    uint32_t ticket = __atomic_fetch_add(&bench->ticketNext, 1, __ATOMIC_RELAXED);
+    (void)threadData;
+    while (__atomic_load_n(&bench->ticketServing, __ATOMIC_ACQUIRE) != ticket) CpuRelax();
+}
+
+static inline void TicketRelease(LockBenchmark *bench, LockThreadData *threadData) {
+    (void)threadData;
+    __atomic_store_n(&bench->ticketServing, bench->ticketServing + 1, __ATOMIC_RELEASE);
+}
+
+// each waiter spins on its own node, and the owner hands off by clearing its successor's flag
+static inline void McsAcquire(LockBenchmark *bench, LockThreadData *threadData) {
+    LockNode *node = threadData->node;
+    node->next = NULL;
+    node->locked = 1;
+    LockNode *pred = __atomic_exchange_n(&bench->mcsTail, node, __ATOMIC_ACQ_REL);
+    if (pred == NULL) return;
+    __atomic_store_n(&pred->next, node, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) CpuRelax();
+}
+
+static inline void McsRelease(LockBenchmark *bench, LockThreadData *threadData) {
+    LockNode *node = threadData->node, *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    if (next == NULL) {
+        LockNode *expected = node;
+        if (__atomic_compare_exchange_n(&bench->mcsTail, &expected, NULL, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) return;
+        // someone's enqueueing behind us but hasn't linked in yet
+        while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL) CpuRelax();
+    }
+
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+// each waiter spins on its predecessor's node
+static inline void ClhAcquire(LockBenchmark *bench, LockThreadData *threadData) {
+    threadData->node->locked = 1;
+    threadData->pred = __atomic_exchange_n(&bench->clhTail, threadData->node, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&threadData->pred->locked, __ATOMIC_ACQUIRE)) CpuRelax();
+}
+
+static inline void ClhRelease(LockBenchmark *bench, LockThreadData *threadData) {
+    (void)bench;
+    __atomic_store_n(&threadData->node->locked, 0, __ATOMIC_RELEASE);
+    threadData->node = threadData->pred;
+}
+
+static inline void MutexAcquire(LockBenchmark *bench, LockThreadData *threadData) { (void)threadData; pthread_mutex_lock(&bench->mutex); }
+static inline void MutexRelease(LockBenchmark *bench, LockThreadData *threadData) { (void)threadData; pthread_mutex_unlock(&bench->mutex); }
+
+// futex word is 0 when unlocked, 1 when locked, 2 when locked with possible sleepers
+static inline void FutexAcquire(LockBenchmark *bench, LockThreadData *threadData) {
+    int expected = 0;
+    (void)threadData;
+    if (__atomic_compare_exchange_n(&bench->futexWord, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+    if (expected != 2) expected = __atomic_exchange_n(&bench->futexWord, 2, __ATOMIC_ACQUIRE);
+    while (expected != 0) {
+        syscall(SYS_futex, &bench->futexWord, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+        expected = __atomic_exchange_n(&bench->futexWord, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static inline void FutexRelease(LockBenchmark *bench, LockThreadData *threadData) {
+    (void)threadData;
+    if (__atomic_exchange_n(&bench->futexWord, 0, __ATOMIC_RELEASE) == 2)
+        syscall(SYS_futex, &bench->futexWord, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static inline void RwlockAcquire(LockBenchmark *bench, LockThreadData *threadData) { (void)threadData; pthread_rwlock_wrlock(&bench->rwlock); }
+static inline void RwlockRelease(LockBenchmark *bench, LockThreadData *threadData) { (void)threadData; pthread_rwlock_unlock(&bench->rwlock); }
+
+// takes and releases the lock until the test duration's up. a handoff is timed from the
+// previous owner's release to this thread getting the lock, using timestamps kept under the lock
+#define LOCK_THREAD(name, acquireFunc, releaseFunc)                                         \
+    void name(void *param) {                                                                \
+        LockThreadData *threadData = (LockThreadData *)param;                               \
+        LockBenchmark *bench = threadData->bench;                                           \
+        uint64_t startNs = GetNs(), nowNs = startNs;                                        \
+        while (nowNs - startNs < bench->durationNs) {                                       \
+            acquireFunc(bench, threadData);                                                 \
+            nowNs = GetNs();                                                                \
+            if (bench->lastOwner >= 0 && bench->lastOwner != threadData->threadIdx) {       \
+                threadData->handoffs++;                                                     \
+                threadData->handoffNs += nowNs - bench->lastReleaseNs;                      \
+            }                                                                               \
+            bench->counter++;                                                               \
+            DoWork(bench->csWork);                                                          \
+            bench->lastOwner = threadData->threadIdx;                                       \
+            bench->lastReleaseNs = GetNs();                                                 \
+            releaseFunc(bench, threadData);                                                 \
+            threadData->acquisitions++;                                                     \
+            DoWork(bench->outsideWork);                                                     \
+        }                                                                                   \
+        threadData->elapsedNs = nowNs - startNs;                                            \
+    }
+
+LOCK_THREAD(TasLockThread, TasAcquire, TasRelease)
+LOCK_THREAD(TtasLockThread, TtasAcquire, TasRelease)
+LOCK_THREAD(TicketLockThread, TicketAcquire, TicketRelease)
+LOCK_THREAD(McsLockThread, McsAcquire, McsRelease)
+LOCK_THREAD(ClhLockThread, ClhAcquire, ClhRelease)
+LOCK_THREAD(MutexLockThread, MutexAcquire, MutexRelease)
+LOCK_THREAD(FutexLockThread, FutexAcquire, FutexRelease)
+LOCK_THREAD(RwlockLockThread, RwlockAcquire, RwlockRelease)
+
+// readPercent of every 100 acquisitions take the read lock. readers hold it together, so they
+// bump the counter atomically and clear lastOwner, and only direct writer to writer handoffs are timed
+void RwlockReadThread(void *param) {
+    LockThreadData *threadData = (LockThreadData *)param;
+    LockBenchmark *bench = threadData->bench;
+    uint64_t startNs = GetNs(), nowNs = startNs;
+    for (uint64_t i = 0; nowNs - startNs < bench->durationNs; i++) {
+        if ((int)(i % 100) < bench->readPercent) {
+            pthread_rwlock_rdlock(&bench->rwlock);
+            nowNs = GetNs();
+            __atomic_fetch_add(&bench->counter, 1, __ATOMIC_RELAXED);
+            DoWork(bench->csWork);
+            __atomic_store_n(&bench->lastOwner, -1, __ATOMIC_RELAXED);
+        } else {
+            pthread_rwlock_wrlock(&bench->rwlock);
+            nowNs = GetNs();
+            if (bench->lastOwner >= 0 && bench->lastOwner != threadData->threadIdx) {
+                threadData->handoffs++;
+                threadData->handoffNs += nowNs - bench->lastReleaseNs;
+            }
+            bench->counter++;
+            DoWork(bench->csWork);
+            bench->lastOwner = threadData->threadIdx;
+            bench->lastReleaseNs = GetNs();
+        }
+
+        pthread_rwlock_unlock(&bench->rwlock);
+        threadData->acquisitions++;
+        DoWork(bench->outsideWork);
+    }
+
+    threadData->elapsedNs = nowNs - startNs;
+}
+
+TestVariant lockVariants[] = {
+    { "tas", TasLockThread, AlwaysSupported },
+    { "ttas", TtasLockThread, AlwaysSupported },
+    { "ticket", TicketLockThread, AlwaysSupported },
+    { "mcs", McsLockThread, AlwaysSupported },
+    { "clh", ClhLockThread, AlwaysSupported },
+    { "mutex", MutexLockThread, AlwaysSupported },
+    { "futex", FutexLockThread, AlwaysSupported },
+    { "rwlock", RwlockLockThread, AlwaysSupported },
+    { "rwlock-read", RwlockReadThread, AlwaysSupported },
+};
+
+// slots in each message ring. a power of 2
+#define QUEUE_SLOTS 1024
+#define QUEUE_BATCH 32
+#define MPSC_MAX_PRODUCERS 3
+
+const char *placement_names[] = { "SMT sibling", "same L3", "cross L3", "cross socket" };
+const char *queue_names[] = { "spsc", "spsc cached", "spsc batch", "mpsc" };
+
+// lock-free ring. SPSC uses head/tail and slots. MPSC uses tail as the producers' ticket counter,
+// and a per-slot sequence number to say when each slot's been written
+typedef struct MessageRing {
+    uint64_t head __attribute__((aligned(64)));  // written by the consumer
+    uint64_t cachedTail;                          // consumer's last look at tail
+    uint64_t tail __attribute__((aligned(64)));  // written by the producer(s)
+    uint64_t cachedHead;                          // producer's last look at head
+    uint64_t slots[QUEUE_SLOTS] __attribute__((aligned(64)));
+    uint64_t seqs[QUEUE_SLOTS] __attribute__((aligned(64)));
+} MessageRing;
+
+enum QueueKind { QUEUE_SPSC, QUEUE_SPSC_CACHED, QUEUE_SPSC_BATCH, QUEUE_MPSC };
+
+typedef struct QueueThreadData {
+    MessageRing *ring;       // sends go here, or for the consumer/echo side, receives come from here
+    MessageRing *replyRing;  // for round trips
+    int kind;
+    uint64_t messages;       // to send, or to receive for the consumer
+    uint64_t firstValue;     // producer sends firstValue, firstValue + 1, ...
+    uint64_t sum;            // consumer's sum of received values, to check nothing got lost
+    uint64_t startNs, endNs;
+} __attribute__((aligned(64))) QueueThreadData;
+
+void InitMessageRing(MessageRing *ring) {
+    memset(ring, 0, sizeof(MessageRing));
+    for (uint64_t i = 0; i < QUEUE_SLOTS; i++) ring->seqs[i] = i;
+}
+
+// Lamport ring. the cached versions only look at the other side's index when the ring
+// seems full/empty, so the index lines don't bounce on every message
+static inline void SpscPush(MessageRing *ring, uint64_t value, int cached) {
+    uint64_t tail = ring->tail;
+    if (cached) {
+        while (tail - ring->cachedHead >= QUEUE_SLOTS) {
+            ring->cachedHead = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            if (tail - ring->cachedHead >= QUEUE_SLOTS) CpuRelax();
+        }
+    } else {
+        while (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= QUEUE_SLOTS) CpuRelax();
+    }
+
+    ring->slots[tail & (QUEUE_SLOTS - 1)] = value;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t SpscPop(MessageRing *ring, int cached) {
+    uint64_t head = ring->head;
+    if (cached) {
+        while (ring->cachedTail == head) {
+            ring->cachedTail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+            if (ring->cachedTail == head) CpuRelax();
+        }
+    } else {
+        while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head) CpuRelax();
+    }
+
+    uint64_t value = ring->slots[head & (QUEUE_SLOTS - 1)];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return value;
+}
+
+// bounded MPSC (Vyukov style). a producer takes a ticket, waits for its slot to be free, then
+// publishes through the slot's sequence number rather than a shared index
+static inline void MpscPush(MessageRing *ring, uint64_t value) {
+    uint64_t ticket = __atomic_fetch_add(&ring->tail, 1, __ATOMIC_RELAXED);
+    uint64_t idx = ticket & (QUEUE_SLOTS - 1);
+    while (__atomic_load_n(&ring->seqs[idx], __ATOMIC_ACQUIRE) != ticket) CpuRelax();
+    ring->slots[idx] = value;
+    __atomic_store_n(&ring->seqs[idx], ticket + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t MpscPop(MessageRing *ring) {
+    uint64_t head = ring->head, idx = head & (QUEUE_SLOTS - 1);
+    while (__atomic_load_n(&ring->seqs[idx], __ATOMIC_ACQUIRE) != head + 1) CpuRelax();
+    uint64_t value = ring->slots[idx];
+    __atomic_store_n(&ring->seqs[idx], head + QUEUE_SLOTS, __ATOMIC_RELEASE);
+    ring->head = head + 1;
+    return value;
+}
+
+static inline void QueuePush(MessageRing *ring, int kind, uint64_t value) {
+    if (kind == QUEUE_MPSC) MpscPush(ring, value);
+    else SpscPush(ring, value, kind != QUEUE_SPSC);
+}
+
+static inline uint64_t QueuePop(MessageRing *ring, int kind) {
+    if (kind == QUEUE_MPSC) return MpscPop(ring);
+    return SpscPop(ring, kind != QUEUE_SPSC);
+}
+
+void QueueProducerThread(void *param) {
+    QueueThreadData *queueData = (QueueThreadData *)param;
+    MessageRing *ring = queueData->ring;
+    uint64_t value = queueData->firstValue, end = queueData->firstValue + queueData->messages;
+    queueData->startNs = GetNs();
+    if (queueData->kind == QUEUE_SPSC_BATCH) {
+        // write a batch of slots, then publish them all with one tail update
+        while (value < end) {
+            uint64_t tail = ring->tail, batch = end - value < QUEUE_BATCH ? end - value : QUEUE_BATCH;
+            while (tail + batch - ring->cachedHead > QUEUE_SLOTS) {
+                ring->cachedHead = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+                if (tail + batch - ring->cachedHead > QUEUE_SLOTS) CpuRelax();
+            }
+
+            for (uint64_t i = 0; i < batch; i++) ring->slots[(tail + i) & (QUEUE_SLOTS - 1)] = value++;
+            __atomic_store_n(&ring->tail, tail + batch, __ATOMIC_RELEASE);
+        }
+    } else {
+        for (; value < end; value++) QueuePush(ring, queueData->kind, value);
+    }
+
+    queueData->endNs = GetNs();
+}
+
+void QueueConsumerThread(void *param) {
+    QueueThreadData *queueData = (QueueThreadData *)param;
+    MessageRing *ring = queueData->ring;
+    uint64_t sum = 0, received = 0;
+    queueData->startNs = GetNs();
+    if (queueData->kind == QUEUE_SPSC_BATCH) {
+        // take everything that's there, then free it all with one head update
+        while (received < queueData->messages) {
+            uint64_t head = ring->head;
+            while (ring->cachedTail == head) {
+                ring->cachedTail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+                if (ring->cachedTail == head) CpuRelax();
+            }
+
+            uint64_t available = ring->cachedTail - head;
+            for (uint64_t i = 0; i < available; i++) sum += ring->slots[(head + i) & (QUEUE_SLOTS - 1)];
+            __atomic_store_n(&ring->head, head + available, __ATOMIC_RELEASE);
+            received += available;
+        }
+    } else {
+        for (; received < queueData->messages; received++) sum += QueuePop(ring, queueData->kind);
+    }
+
+    queueData->endNs = GetNs();
+    queueData->sum = sum;
+}
+
+// sends a message and waits for the echo before sending the next one
+void QueuePingThread(void *param) {
+    QueueThreadData *queueData = (QueueThreadData *)param;
+    queueData->startNs = GetNs();
+    for (uint64_t i = 1; i <= queueData->messages; i++) {
+        QueuePush(queueData->ring, queueData->kind, i);
+        if (QueuePop(queueData->replyRing, queueData->kind) != i) fprintf(stderr, "Round trip got the wrong message back\n");
+    }
+
+    queueData->endNs = GetNs();
+}
+
+void QueueEchoThread(void *param) {
+    QueueThreadData *queueData = (QueueThreadData *)param;
+    for (uint64_t i = 0; i < queueData->messages; i++) QueuePush(queueData->replyRing, queueData->kind, QueuePop(queueData->ring, queueData->kind));
+}
+
+// lines in the MESI test's pointer chase. small enough to stay in L1
+#define MESI_LINES 128
+
+// every round is a couple of pool dispatches per table entry, so this needs far fewer than ITERATIONS
+#define MESI_ROUNDS 1000
+
+const char *mesi_scenarios[] = { "modified", "exclusive", "shared", "invalidate" };
+
+typedef struct MesiThreadData {
+    void **start;         // first line in the chase
+    uint64_t elapsedNs;   // written by the thread
+    void *end;            // where the chase ended up, so it doesn't get optimized out
+} __attribute__((aligned(64))) MesiThreadData;
+
+// evicts a line from every cache in the coherency domain
+static inline void FlushLine(void *line) {
+#ifdef __x86_64
+    __asm__ __volatile__("clflush (%0)" : : "r"(line) : "memory");
+#elif defined(__aarch64__)
+    __asm__ __volatile__("dc civac, %0" : : "r"(line) : "memory");
+#endif
+}
+
+static inline void FlushFence() {
+#ifdef __x86_64
+    __asm__ __volatile__("mfence" : : : "memory");
+#elif defined(__aarch64__)
+    __asm__ __volatile__("dsb ish" : : : "memory");
+#endif
+}
+
+// lines are visited in random order, and each load depends on the last one
+void MesiReadThread(void *param) {
+    MesiThreadData *mesiData = (MesiThreadData *)param;
+    void **line = mesiData->start;
+    uint64_t startNs = GetNs();
+    for (int i = 0; i < MESI_LINES; i++) line = (void **)*line;
+    mesiData->elapsedNs = GetNs() - startNs;
+    mesiData->end = line;
+}
+
+// dirties each line with a store next to the chase pointer
+void MesiWriteThread(void *param) {
+    MesiThreadData *mesiData = (MesiThreadData *)param;
+    void **line = mesiData->start;
+    uint64_t startNs = GetNs();
+    for (int i = 0; i < MESI_LINES; i++) {
+        void **next = (void **)*line;
+        line[1] = next;
+        line = next;
+    }
+
+    mesiData->elapsedNs = GetNs() - startNs;
+    mesiData->end = line;
+}
+
+// an atomic add of 0 needs the line in an exclusive state like a write does, but
+// returns the next pointer, so each line's ownership request waits on the last one
+void MesiRmwThread(void *param) {
+    MesiThreadData *mesiData = (MesiThreadData *)param;
+    void **line = mesiData->start;
+    uint64_t startNs = GetNs();
+    for (int i = 0; i < MESI_LINES; i++) line = (void **)__atomic_fetch_add((uint64_t *)line, 0, __ATOMIC_RELAXED);
+    mesiData->elapsedNs = GetNs() - startNs;
+    mesiData->end = line;
+}
+
+// each sample keeps a timestamp delta for the distribution, so keep the default per pair modest
+#define ONEWAY_SAMPLES 100000
+
+typedef struct OneWayThreadData {
+    uint64_t *line;        // carries the sender's timestamp
+    uint64_t samples;      // messages to receive
+    int sendFirst;
+    int64_t *deltas;       // receive timestamp - send timestamp, for each message received
+} __attribute__((aligned(64))) OneWayThreadData;
+
+// both sides take turns sending. a message is the sender's timestamp, and the receiver
+// notes its own timestamp as soon as it sees a new value, then replies with a fresh one
+void OneWayThread(void *param) {
+    OneWayThreadData *oneWayData = (OneWayThreadData *)param;
+    uint64_t *line = oneWayData->line, lastSent = 0;
+    if (oneWayData->sendFirst) {
+        lastSent = ReadTimestamp();
+        __atomic_store_n(line, lastSent, __ATOMIC_RELEASE);
+    }
+
+    for (uint64_t i = 0; i < oneWayData->samples; i++) {
+        uint64_t sent;
+        while ((sent = __atomic_load_n(line, __ATOMIC_ACQUIRE)) == lastSent);
+        oneWayData->deltas[i] = (int64_t)(ReadTimestamp() - sent);
+        lastSent = ReadTimestamp();
+        __atomic_store_n(line, lastSent, __ATOMIC_RELEASE);
+    }
+}
 
 int main(int argc, char *argv[]) {
     float *latencies;
     int numProcs;
     uint64_t iter = ITERATIONS;
+    float (*test)(CorePool *, unsigned int, unsigned int, uint64_t, WorkerFunc) = RunTest;
+    TestVariant *cas = casVariants;
+    CorePool pool;
+    int concurrent = 0;
+
+    // modes that don't take an iteration count can be named first, like "coherencylatency contention xadd"
+    int modeArg = argc > 1 && !isdigit((unsigned char)argv[1][0]) ? 1 : 2;
 
     numProcs = get_nprocs();
     fprintf(stderr, "Number of CPUs: %u\n", numProcs);
     latencies = (float *)malloc(sizeof(float) * numProcs * numProcs);
-    
-    if (argc > 1) {
+    if (latencies == NULL) {
+        fprintf(stderr, "couldn't allocate result array\n");
+        return 0;
+    }
+
+    if (argc > 1 && modeArg == 2) {
         iter = atol(argv[1]);
         fprintf(stderr, "%lu iterations requested\n", iter);
+    } else if (argc <= 1) {
+        fprintf(stderr, "Usage: coherencylatency [iterations] [bounce/owned] [cas variant:");
+        for (unsigned int i = 0; i < sizeof(casVariants) / sizeof(TestVariant); i++) fprintf(stderr, " %s", casVariants[i].name);
+        fprintf(stderr, "] [sequential/concurrent]\n");
+        fprintf(stderr, "       coherencylatency contention [op:");
+        for (unsigned int i = 0; i < sizeof(contentionOps) / sizeof(TestVariant); i++) fprintf(stderr, " %s", contentionOps[i].name);
+        fprintf(stderr, "] [lines] [cpu list, like 0,1,2]\n");
+        fprintf(stderr, "       coherencylatency [iterations] atomics\n");
+        fprintf(stderr, "       coherencylatency [messages] queues\n");
+        fprintf(stderr, "       coherencylatency [samples, default %d] oneway\n", ONEWAY_SAMPLES);
+        fprintf(stderr, "       coherencylatency [rounds, default %d] mesi [all/modified/exclusive/shared/invalidate] [max sharers]\n", MESI_ROUNDS);
+        fprintf(stderr, "       coherencylatency locks [all/tas/ttas/ticket/mcs/clh/mutex/futex/rwlock/rwlock-read] [critical section work] [outside work] [cpu list, like 0,1,2] [rwlock-read read %%, default 90]\n");
     }
 
-    for (int i = 0;i < numProcs; i++) {
-        for (int j = 0;j < numProcs; j++) {
-            latencies[j + i * numProcs] = i == j ? 0 : RunTest(i, j, iter);
+    if (argc > modeArg && strncmp(argv[modeArg], "atomics", 7) == 0) {
+        fprintf(stderr, "Testing atomic ops and memory orders with %lu iterations\n", iter);
+        if (!CreateCorePool(&pool, numProcs)) return 0;
+        RunAtomicsTest(&pool, numProcs, iter);
+        DestroyCorePool(&pool);
+        return 0;
+    }
+
+    if (argc > modeArg && strncmp(argv[modeArg], "mesi", 4) == 0) {
+        int scenario = -1, maxSharers = numProcs - 1;
+        if (modeArg == 1) iter = MESI_ROUNDS;
+        if (argc > modeArg + 1 && strcmp(argv[modeArg + 1], "all") != 0) {
+            for (unsigned int i = 0; i < sizeof(mesi_scenarios) / sizeof(mesi_scenarios[0]); i++)
+                if (strcmp(argv[modeArg + 1], mesi_scenarios[i]) == 0) scenario = i;
+            if (scenario == -1) {
+                fprintf(stderr, "Unknown scenario %s\n", argv[modeArg + 1]);
+                return 0;
+            }
+        }
+
+        if (argc > modeArg + 2) maxSharers = atoi(argv[modeArg + 2]);
+        fprintf(stderr, "Testing coherency state transitions, best of %lu rounds\n", iter);
+        if (!CreateCorePool(&pool, numProcs)) return 0;
+        RunMesiTest(&pool, numProcs, iter, scenario, maxSharers);
+        DestroyCorePool(&pool);
+        return 0;
+    }
+
+    if (argc > modeArg && strncmp(argv[modeArg], "oneway", 6) == 0) {
+        if (modeArg == 1) iter = ONEWAY_SAMPLES;
+        if (iter == 0) return 0;
+        fprintf(stderr, "Testing one way latency with %lu samples each way\n", iter);
+        if (!CreateCorePool(&pool, numProcs)) return 0;
+        RunOneWayTest(&pool, numProcs, iter);
+        DestroyCorePool(&pool);
+        return 0;
+    }
+
+    if (argc > modeArg && strncmp(argv[modeArg], "queues", 6) == 0) {
+        fprintf(stderr, "Testing message queues with %lu messages\n", iter);
+        if (!CreateCorePool(&pool, numProcs)) return 0;
+        RunQueueTest(&pool, numProcs, iter);
+        DestroyCorePool(&pool);
+        return 0;
+    }
+
+    if (argc > modeArg && strncmp(argv[modeArg], "locks", 5) == 0) {
+        TestVariant *locks = lockVariants;
+        int lockCount = sizeof(lockVariants) / sizeof(TestVariant), cpuCount, readPercent = 90;
+        uint64_t csWork = 0, outsideWork = 0;
+        if (argc > modeArg + 1 && strcmp(argv[modeArg + 1], "all") != 0) {
+            locks = FindVariant(lockVariants, lockCount, argv[modeArg + 1]);
+            lockCount = 1;
+        }
+
+        if (argc > modeArg + 2) csWork = atol(argv[modeArg + 2]);
+        if (argc > modeArg + 3) outsideWork = atol(argv[modeArg + 3]);
+        if (argc > modeArg + 5) readPercent = atoi(argv[modeArg + 5]);
+        if (locks == NULL) return 0;
+        if (readPercent < 0 || readPercent > 100) {
+            fprintf(stderr, "Read percentage %d should be between 0 and 100\n", readPercent);
+            return 0;
         }
+
+        int *cpus = ParseCpuList(argc > modeArg + 4 ? argv[modeArg + 4] : NULL, numProcs, &cpuCount);
+        if (cpus == NULL) return 0;
+        if (cpuCount > 0) {
+            fprintf(stderr, "Lock test: %lu iterations of work inside the lock, %lu outside, %d CPUs, %d%% reads for rwlock-read\n", csWork, outsideWork, cpuCount, readPercent);
+            if (CreateCorePool(&pool, numProcs)) {
+                RunLockTest(&pool, locks, lockCount, cpus, cpuCount, csWork, outsideWork, readPercent);
+                DestroyCorePool(&pool);
+            }
+        }
+
+        free(cpus);
+        return 0;
+    }
+
+    if (argc > modeArg && strncmp(argv[modeArg], "contention", 10) == 0) {
+        TestVariant *op = contentionOps;
+        int lineCount = 1, cpuCount;
+        if (argc > modeArg + 1) op = FindVariant(contentionOps, sizeof(contentionOps) / sizeof(TestVariant), argv[modeArg + 1]);
+        if (argc > modeArg + 2) lineCount = atoi(argv[modeArg + 2]);
+        if (op == NULL || lineCount < 1) return 0;
+
+        int *cpus = ParseCpuList(argc > modeArg + 3 ? argv[modeArg + 3] : NULL, numProcs, &cpuCount);
+        if (cpus == NULL) return 0;
+        if (cpuCount > 0) {
+            fprintf(stderr, "Testing contended %s on %d CPUs, %d ms per thread count\n", op->name, cpuCount, CONTENTION_TEST_MS);
+            if (CreateCorePool(&pool, numProcs)) {
+                RunContentionTest(&pool, cpus, cpuCount, op, lineCount);
+                DestroyCorePool(&pool);
+            }
+        }
+
+        free(cpus);
+        return 0;
+    }
+
+    if (argc > modeArg && strncmp(argv[modeArg], "owned", 5) == 0) {
+        test = RunOwnedTest;
+        fprintf(stderr, "Using separate cache lines for each thread to write to\n");
     }
 
+    if (argc > modeArg + 1) {
+        cas = FindVariant(casVariants, sizeof(casVariants) / sizeof(TestVariant), argv[modeArg + 1]);
+        if (cas == NULL) return 0;
+    }
+
+    if (argc > modeArg + 2 && strncmp(argv[modeArg + 2], "concurrent", 10) == 0) {
+        concurrent = 1;
+        fprintf(stderr, "Testing disjoint pairs concurrently\n");
+    }
+
+    if (test == RunTest) fprintf(stderr, "Using %s compare and swap\n", cas->name);
+    if (!CreateCorePool(&pool, numProcs)) return 0;
+
+    if (concurrent) {
+        RunConcurrentMatrix(&pool, numProcs, iter, test == RunOwnedTest, cas->threadFunc, latencies);
+    } else {
+        for (int i = 0;i < numProcs; i++) {
+            for (int j = 0;j < numProcs; j++) {
+                latencies[j + i * numProcs] = i == j ? 0 : test(&pool, i, j, iter, cas->threadFunc);
+            }
+        }
+    }
+
+    DestroyCorePool(&pool);
+
     for (int i = 0;i < numProcs; i++) {
-        for (int j = 0;j < numProcs; j++) { 
+        for (int j = 0;j < numProcs; j++) {
             if (j != 0) printf(",");
             if (j == i) printf("x");
             // to maintain consistency, divide by 2 (see justification in windows version)
@@ -56,72 +1122,1025 @@ int main(int argc, char *argv[]) {
         printf("\n");
     }
 
+    InferTopology(latencies, numProcs);
+    free(latencies);
     return 0;
 }
 
-// run test and gather timing data using the specified thread function
-float TimeThreads(unsigned int proc1, 
-                  unsigned int proc2, 
-                  uint64_t iter, 
-                  LatencyData *lat1, 
-                  LatencyData *lat2,
-                  void *(*threadFunc)(void *)) {
-    struct timeval startTv, endTv;
-    struct timezone startTz, endTz;
-    pthread_t testThreads[2];
-    int t1rc, t2rc;
-    void *res1, *res2;
+// looks up a variant by name, and makes sure the CPU can run it
+TestVariant *FindVariant(TestVariant *variants, int count, const char *name) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, variants[i].name) != 0) continue;
+        if (variants[i].supported()) return variants + i;
+        fprintf(stderr, "%s is not supported on this CPU\n", name);
+        return NULL;
+    }
 
-    gettimeofday(&startTv, &startTz);
-    t1rc = pthread_create(&testThreads[0], NULL, threadFunc, (void *)lat1); 
-    t2rc = pthread_create(&testThreads[1], NULL, threadFunc, (void *)lat2); 
-    if (t1rc != 0 || t2rc != 0) {
-      fprintf(stderr, "Could not create threads\n");
-      return 0;
+    fprintf(stderr, "Unknown variant %s, expected one of:", name);
+    for (int i = 0; i < count; i++) fprintf(stderr, " %s", variants[i].name);
+    fprintf(stderr, "\n");
+    return NULL;
+}
+
+// parses a CPU list like 0,2,4, or gives every CPU in order if list is NULL. returns NULL
+// if a CPU is out of range or listed twice, since two threads can't share one CPU's worker
+int *ParseCpuList(char *list, int numProcs, int *cpuCount) {
+    int *cpus = (int *)malloc(numProcs * sizeof(int));
+    if (list == NULL) {
+        for (int i = 0; i < numProcs; i++) cpus[i] = i;
+        *cpuCount = numProcs;
+        return cpus;
     }
 
-    pthread_join(testThreads[0], &res1);
-    pthread_join(testThreads[1], &res2);
-    gettimeofday(&endTv, &endTz);
+    *cpuCount = 0;
+    for (char *cpuStr = strtok(list, ","); cpuStr != NULL; cpuStr = strtok(NULL, ",")) {
+        int cpu = atoi(cpuStr);
+        if (cpu < 0 || cpu >= numProcs) {
+            fprintf(stderr, "CPU %s out of range\n", cpuStr);
+            free(cpus);
+            return NULL;
+        }
 
-    uint64_t time_diff_ms = 1000 * (endTv.tv_sec - startTv.tv_sec) + ((endTv.tv_usec - startTv.tv_usec) / 1000);
-    float latency = 1e6 * (float)time_diff_ms / (float)iter;
-    return latency;
+        for (int i = 0; i < *cpuCount; i++) {
+            if (cpus[i] != cpu) continue;
+            fprintf(stderr, "CPU %d is listed more than once\n", cpu);
+            free(cpus);
+            return NULL;
+        }
+
+        cpus[(*cpuCount)++] = cpu;
+    }
+
+    return cpus;
+}
+
+void *CoreWorkerThread(void *param) {
+    CoreWorker *worker = (CoreWorker *)param;
+    CorePool *pool = worker->pool;
+    SetCurrentThreadAffinity(worker->processor);
+    while (1) {
+        pthread_mutex_lock(&worker->lock);
+        while (worker->func == NULL && !pool->quit) pthread_cond_wait(&worker->cond, &worker->lock);
+        WorkerFunc func = worker->func;
+        worker->func = NULL;
+        pthread_mutex_unlock(&worker->lock);
+        if (func == NULL) break;
+
+        // spin rather than block from here, so the other side of the pair gets going right away
+        __atomic_add_fetch(&pool->ready, 1, __ATOMIC_SEQ_CST);
+        while (!__atomic_load_n(&pool->go, __ATOMIC_ACQUIRE));
+        func(worker->jobData);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->finished++;
+        pthread_cond_signal(&pool->doneCond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+// starts one worker pinned to each CPU. they block until given a test
+int CreateCorePool(CorePool *pool, unsigned int workerCount) {
+    memset(pool, 0, sizeof(CorePool));
+    pool->workerCount = workerCount;
+    pool->workers = (CoreWorker *)calloc(workerCount, sizeof(CoreWorker));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->doneCond, NULL);
+    for (unsigned int i = 0; i < workerCount; i++) {
+        CoreWorker *worker = pool->workers + i;
+        worker->processor = i;
+        worker->pool = pool;
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->cond, NULL);
+        if (pthread_create(&worker->handle, NULL, CoreWorkerThread, worker) != 0) {
+            fprintf(stderr, "Could not create worker thread for CPU %u\n", i);
+            pool->workerCount = i;
+            DestroyCorePool(pool);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void DestroyCorePool(CorePool *pool) {
+    pool->quit = 1;
+    for (unsigned int i = 0; i < pool->workerCount; i++) {
+        CoreWorker *worker = pool->workers + i;
+        pthread_mutex_lock(&worker->lock);
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->lock);
+        pthread_join(worker->handle, NULL);
+        pthread_mutex_destroy(&worker->lock);
+        pthread_cond_destroy(&worker->cond);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->doneCond);
+    free(pool->workers);
+}
+
+// gives the worker on a CPU something to run. it'll wait for RunAssignedTests. a worker only
+// runs one test at a time, so a second assignment before the run is refused
+void AssignWorker(CorePool *pool, unsigned int processor, WorkerFunc func, void *jobData) {
+    CoreWorker *worker = pool->workers + processor;
+    if (worker->assigned) {
+        fprintf(stderr, "CPU %u already has a test assigned\n", processor);
+        return;
+    }
+
+    worker->assigned = 1;
+    pthread_mutex_lock(&worker->lock);
+    worker->jobData = jobData;
+    worker->func = func;
+    pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&worker->lock);
+    pool->assigned++;
+}
+
+// hands both sides of a test to the workers on their CPUs
+void AssignPairTest(CorePool *pool, PairTest *test, WorkerFunc threadFunc) {
+    AssignWorker(pool, test->lat1.processorIndex, threadFunc, &test->lat1);
+    AssignWorker(pool, test->lat2.processorIndex, threadFunc, &test->lat2);
+}
+
+// releases every assigned worker at once with the go flag, then waits for all of them to finish
+void RunAssignedTests(CorePool *pool) {
+    while (__atomic_load_n(&pool->ready, __ATOMIC_ACQUIRE) < pool->assigned) sched_yield();
+    __atomic_store_n(&pool->go, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->finished < pool->assigned) pthread_cond_wait(&pool->doneCond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    __atomic_store_n(&pool->go, 0, __ATOMIC_RELAXED);
+    pool->ready = 0;
+    pool->finished = 0;
+    pool->assigned = 0;
+    for (unsigned int i = 0; i < pool->workerCount; i++) pool->workers[i].assigned = 0;
+}
+
+/// <summary>
+/// Sets up a test between two CPUs. The bounce test has both sides CAS one location,
+/// while the owned test has each side write its own cache line and poll the other's
+/// </summary>
+void SetupPairTest(PairTest *test, unsigned int processor1, unsigned int processor2, uint64_t iter, int owned) {
+    // drop owned test targets on different cache lines
+    test->buffer = (uint64_t *)aligned_alloc(64, 128);
+    test->buffer[0] = owned ? 1 : 0;
+    test->buffer[1] = 0;
+    test->buffer[8] = 0;
+    test->lat1.iterations = iter;
+    test->lat1.start = owned ? 3 : 1;
+    test->lat1.target = test->buffer;
+    test->lat1.readTarget = test->buffer + 8;
+    test->lat1.processorIndex = processor1;
+    test->lat2.iterations = iter;
+    test->lat2.start = 2;
+    test->lat2.target = owned ? test->buffer + 8 : test->buffer;
+    test->lat2.readTarget = test->buffer;
+    test->lat2.processorIndex = processor2;
+}
+
+/// <summary>
+/// Works out latency from the first handoff to the last one, and frees the test's memory
+/// </summary>
+/// <returns>ns per iteration, where each iteration is a round trip (two handoffs)</returns>
+float FinishPairTest(PairTest *test) {
+    uint64_t firstNs = test->lat1.firstNs < test->lat2.firstNs ? test->lat1.firstNs : test->lat2.firstNs;
+    uint64_t endNs = test->lat1.endNs > test->lat2.endNs ? test->lat1.endNs : test->lat2.endNs;
+    free(test->buffer);
+
+    // 2 * iterations handoffs, but timing starts on the first one
+    return (float)(endNs - firstNs) / ((float)test->lat1.iterations - 0.5f);
 }
 
 // test latency between two logical CPUs
-float RunTest(unsigned int processor1, unsigned int processor2, uint64_t iter) {
-  LatencyData lat1, lat2;
-  uint64_t bouncy;
+float RunTest(CorePool *pool, unsigned int processor1, unsigned int processor2, uint64_t iter, WorkerFunc threadFunc) {
+  PairTest test;
+  float latency;
+
+  SetupPairTest(&test, processor1, processor2, iter, 0);
+  AssignPairTest(pool, &test, threadFunc);
+  RunAssignedTests(pool);
+  latency = FinishPairTest(&test);
+  fprintf(stderr, "%d to %d: %f ns\n", processor1, processor2, latency);
+  return latency;
+}
+
+// same, but each thread writes to its own cache line and watches the other thread's
+float RunOwnedTest(CorePool *pool, unsigned int processor1, unsigned int processor2, uint64_t iter, WorkerFunc threadFunc) {
+  PairTest test;
   float latency;
+  (void)threadFunc; // owned lines are always read, never bounced with a CAS
 
-  bouncy = 0;
-  lat1.iterations = iter;
-  lat1.start = 1;
-  lat1.target = &bouncy;
-  lat1.processorIndex = processor1;
-  lat2.iterations = iter;
-  lat2.start = 2;
-  lat2.target = &bouncy;
-  lat2.processorIndex = processor2;
-  latency = TimeThreads(processor1, processor2, iter, &lat1, &lat2, LatencyTestThread);
+  SetupPairTest(&test, processor1, processor2, iter, 1);
+  AssignPairTest(pool, &test, ReadLatencyTestThread);
+  RunAssignedTests(pool);
+  latency = FinishPairTest(&test);
   fprintf(stderr, "%d to %d: %f ns\n", processor1, processor2, latency);
   return latency;
 }
 
-void *LatencyTestThread(void *param) {
+/// <summary>
+/// Fills the latency matrix by running many disjoint pairs at once. Pairs come from a round robin
+/// tournament (circle method), so every CPU is in at most one pair per round and every pair
+/// meets once. Each round runs twice, with the sides swapped, to fill both halves of the matrix.
+/// Afterward, a sample of pairs is re-run alone and compared, to show how much the concurrent
+/// pairs interfered with each other (shared L3, mesh/ring links, etc.)
+/// </summary>
+void RunConcurrentMatrix(CorePool *pool, int numProcs, uint64_t iter, int owned, WorkerFunc threadFunc, float *latencies) {
+    // with an odd CPU count, add a dummy player and whoever draws it sits the round out
+    int players = numProcs + (numProcs & 1);
+    PairTest *tests = (PairTest *)malloc(players / 2 * sizeof(PairTest));
+    WorkerFunc func = owned ? ReadLatencyTestThread : threadFunc;
+    for (int i = 0; i < numProcs; i++) latencies[i + i * numProcs] = 0;
+
+    for (int round = 0; round < players - 1; round++) {
+        for (int swap = 0; swap < 2; swap++) {
+            int pairCount = 0;
+            for (int k = 0; k < players / 2; k++) {
+                int a = k == 0 ? players - 1 : (round + k) % (players - 1);
+                int b = (round - k + players - 1) % (players - 1);
+                if (a >= numProcs || b >= numProcs) continue;
+                SetupPairTest(tests + pairCount, swap ? b : a, swap ? a : b, iter, owned);
+                AssignPairTest(pool, tests + pairCount, func);
+                pairCount++;
+            }
+
+            RunAssignedTests(pool);
+            for (int pairIdx = 0; pairIdx < pairCount; pairIdx++) {
+                unsigned int p1 = tests[pairIdx].lat1.processorIndex, p2 = tests[pairIdx].lat2.processorIndex;
+                latencies[p2 + p1 * numProcs] = FinishPairTest(tests + pairIdx);
+                fprintf(stderr, "%u to %u: %f ns\n", p1, p2, latencies[p2 + p1 * numProcs]);
+            }
+        }
+
+        fprintf(stderr, "Round %d of %d done\n", round + 1, players - 1);
+    }
+
+    // same sample every run, so validation results are comparable between machines
+    int samples = numProcs * (numProcs - 1) < VALIDATION_SAMPLES ? numProcs * (numProcs - 1) : VALIDATION_SAMPLES;
+    float totalDelta = 0, maxDelta = 0;
+    uint64_t seed = 1;
+    for (int sampleIdx = 0; sampleIdx < samples; sampleIdx++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        unsigned int p1 = (seed >> 33) % numProcs;
+        unsigned int p2 = (p1 + 1 + (seed >> 13) % (numProcs - 1)) % numProcs;
+        float concurrentLatency = latencies[p2 + p1 * numProcs];
+        float sequentialLatency = owned ? RunOwnedTest(pool, p1, p2, iter, threadFunc) : RunTest(pool, p1, p2, iter, threadFunc);
+        float delta = 100 * (concurrentLatency - sequentialLatency) / sequentialLatency;
+        fprintf(stderr, "Validation %u to %u: %f ns concurrent, %f ns alone, %+.2f%%\n", p1, p2, concurrentLatency, sequentialLatency, delta);
+        totalDelta += delta;
+        if (fabsf(delta) > fabsf(maxDelta)) maxDelta = delta;
+    }
+
+    if (samples > 0) fprintf(stderr, "Interference: %+.2f%% average, %+.2f%% worst over %d pairs\n", totalDelta / samples, maxDelta, samples);
+    free(tests);
+}
+
+/// <summary>
+/// Has 1 to cpuCount threads, pinned to the CPUs in cpus in order, hammer one line with atomic
+/// increments, then again with threads spread over lineCount lines. Reports total throughput, the
+/// slowest and fastest thread, and Jain's fairness index (1 = every thread got the same share)
+/// </summary>
+void RunContentionTest(CorePool *pool, int *cpus, int cpuCount, TestVariant *op, int lineCount) {
+    ContentionThreadData *contentionData = (ContentionThreadData *)aligned_alloc(64, cpuCount * sizeof(ContentionThreadData));
+    uint64_t *lines = (uint64_t *)aligned_alloc(64, lineCount * CONTENTION_LINE_BYTES);
+    int lineCounts[2] = { 1, lineCount };
+
+    printf("Threads,Lines,Total Mops/s,Min thread Mops/s,Max thread Mops/s,Fairness\n");
+    for (int lineIdx = 0; lineIdx < (lineCount > 1 ? 2 : 1); lineIdx++) {
+        int usedLines = lineCounts[lineIdx];
+        for (int threads = 1; threads <= cpuCount; threads++) {
+            memset(lines, 0, lineCount * CONTENTION_LINE_BYTES);
+            for (int t = 0; t < threads; t++) {
+                contentionData[t].target = lines + (t % usedLines) * (CONTENTION_LINE_BYTES / sizeof(uint64_t));
+                contentionData[t].durationNs = CONTENTION_TEST_MS * 1000000ULL;
+                AssignWorker(pool, cpus[t], op->threadFunc, contentionData + t);
+            }
+
+            RunAssignedTests(pool);
+            double total = 0, sumSquares = 0, minRate = 0, maxRate = 0;
+            for (int t = 0; t < threads; t++) {
+                double rate = 1000.0 * contentionData[t].ops / contentionData[t].elapsedNs;
+                total += rate;
+                sumSquares += rate * rate;
+                if (t == 0 || rate < minRate) minRate = rate;
+                if (t == 0 || rate > maxRate) maxRate = rate;
+            }
+
+            double fairness = total * total / (threads * sumSquares);
+            fprintf(stderr, "%d threads on %d lines: %f Mops/s, fairness %f\n", threads, usedLines, total, fairness);
+            printf("%d,%d,%f,%f,%f,%f\n", threads, usedLines, total, minRate, maxRate, fairness);
+            fflush(stdout);
+        }
+    }
+
+    free(lines);
+    free(contentionData);
+}
+
+/// <summary>
+/// Runs each lock with 1 to cpuCount threads, pinned to the CPUs in cpus in order, so the
+/// CPU list picks the placement (SMT siblings, same cluster, cross socket...). Reports
+/// acquisitions per second, average handoff latency between different threads, and
+/// Jain's fairness index over per-thread acquisition rates. rwlock-read takes the read
+/// lock for readPercent of its acquisitions
+/// </summary>
+void RunLockTest(CorePool *pool, TestVariant *locks, int lockCount, int *cpus, int cpuCount, uint64_t csWork, uint64_t outsideWork, int readPercent) {
+    LockBenchmark *bench = (LockBenchmark *)aligned_alloc(64, sizeof(LockBenchmark));
+    LockThreadData *threadData = (LockThreadData *)aligned_alloc(64, cpuCount * sizeof(LockThreadData));
+    // one node per thread, plus CLH's initial unlocked node
+    LockNode *nodes = (LockNode *)aligned_alloc(64, (cpuCount + 1) * sizeof(LockNode));
+
+    printf("Lock,Threads,Macquisitions/s,Handoff latency (ns),Fairness\n");
+    for (int lockIdx = 0; lockIdx < lockCount; lockIdx++) {
+        for (int threads = 1; threads <= cpuCount; threads++) {
+            memset(bench, 0, sizeof(LockBenchmark));
+            memset(nodes, 0, (cpuCount + 1) * sizeof(LockNode));
+            pthread_mutex_init(&bench->mutex, NULL);
+            pthread_rwlock_init(&bench->rwlock, NULL);
+            bench->clhTail = nodes + cpuCount;
+            bench->lastOwner = -1;
+            bench->csWork = csWork;
+            bench->outsideWork = outsideWork;
+            bench->durationNs = CONTENTION_TEST_MS * 1000000ULL;
+            bench->readPercent = readPercent;
+            memset(threadData, 0, cpuCount * sizeof(LockThreadData));
+            for (int t = 0; t < threads; t++) {
+                threadData[t].bench = bench;
+                threadData[t].threadIdx = t;
+                threadData[t].node = nodes + t;
+                AssignWorker(pool, cpus[t], locks[lockIdx].threadFunc, threadData + t);
+            }
+
+            RunAssignedTests(pool);
+            uint64_t acquisitions = 0, handoffs = 0, handoffNs = 0;
+            double total = 0, sumSquares = 0;
+            for (int t = 0; t < threads; t++) {
+                double rate = 1000.0 * threadData[t].acquisitions / threadData[t].elapsedNs;
+                acquisitions += threadData[t].acquisitions;
+                handoffs += threadData[t].handoffs;
+                handoffNs += threadData[t].handoffNs;
+                total += rate;
+                sumSquares += rate * rate;
+            }
+
+            // the counter is only touched under the lock, so it has to match
+            if (bench->counter != acquisitions) fprintf(stderr, "%s is broken: %lu acquisitions, counter at %lu\n", locks[lockIdx].name, acquisitions, bench->counter);
+            float handoffLatency = handoffs == 0 ? 0 : (float)handoffNs / handoffs;
+            double fairness = total * total / (threads * sumSquares);
+            fprintf(stderr, "%s, %d threads: %f M/s, %f ns handoff, fairness %f\n", locks[lockIdx].name, threads, total, handoffLatency, fairness);
+            printf("%s,%d,%f,%f,%f\n", locks[lockIdx].name, threads, total, handoffLatency, fairness);
+            fflush(stdout);
+            pthread_mutex_destroy(&bench->mutex);
+            pthread_rwlock_destroy(&bench->rwlock);
+        }
+    }
+
+    free(nodes);
+    free(threadData);
+    free(bench);
+}
+
+/// <summary>
+/// Parses a sysfs list like "0-3,8-11" into an array of ints
+/// </summary>
+/// <param name="path">sysfs file to read</param>
+/// <param name="count">set to number of entries</param>
+/// <returns>malloc-ed array of entries, or NULL if the file couldn't be read</returns>
+int *ReadSysfsList(const char *path, int *count) {
+    char buf[4096];
+    char *str = buf, *end;
+    int *list = NULL, capacity = 0;
+    FILE *f = fopen(path, "r");
+    *count = 0;
+    if (f == NULL) return NULL;
+    if (fgets(buf, sizeof(buf), f) == NULL) buf[0] = '\0';
+    fclose(f);
+
+    while (*str != '\0' && *str != '\n') {
+        int first = strtol(str, &end, 10), last = first;
+        if (end == str) break;
+        if (*end == '-') last = strtol(end + 1, &end, 10);
+        for (int i = first; i <= last; i++) {
+            if (*count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                list = (int *)realloc(list, capacity * sizeof(int));
+            }
+
+            list[(*count)++] = i;
+        }
+
+        str = (*end == ',') ? end + 1 : end;
+    }
+
+    if (list == NULL) list = (int *)malloc(sizeof(int));
+    return list;
+}
+
+// returns 1 if cpu2 is in the sysfs list for cpu1
+int SysfsListContains(const char *pathFormat, int cpu1, int cpu2) {
+    char path[256];
+    int count, found = 0;
+    snprintf(path, sizeof(path), pathFormat, cpu1);
+    int *list = ReadSysfsList(path, &count);
+    for (int i = 0; list != NULL && i < count; i++) if (list[i] == cpu2) found = 1;
+    free(list);
+    return found;
+}
+
+int ReadSysfsInt(const char *pathFormat, int cpu) {
+    char path[256];
+    int value = -1;
+    snprintf(path, sizeof(path), pathFormat, cpu);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return -1;
+    if (fscanf(f, "%d", &value) != 1) value = -1;
+    fclose(f);
+    return value;
+}
+
+// returns which sysfs cache index is the CPU's level 3 cache, or -1 if there isn't one
+int GetL3Index(int cpu) {
+    char path[256];
+    for (int index = 0; index < 16; index++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, index);
+        FILE *f = fopen(path, "r");
+        int level = 0;
+        if (f == NULL) break;
+        if (fscanf(f, "%d", &level) != 1) level = 0;
+        fclose(f);
+        if (level == 3) return index;
+    }
+
+    return -1;
+}
+
+// returns 1 if the two CPUs share a level 3 cache, going by sysfs cache info
+int SharesL3(int cpu1, int cpu2) {
+    char path[256];
+    int index = GetL3Index(cpu1);
+    if (index == -1) return 0;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%%d/cache/index%d/shared_cpu_list", index);
+    return SysfsListContains(path, cpu1, cpu2);
+}
+
+/// <summary>
+/// Checks that timestamps can be compared across cores, and gets the timestamp frequency
+/// </summary>
+/// <returns>timestamp ticks per ns, or 0 if timestamps can't be compared across cores</returns>
+float GetTimestampFrequency() {
+#ifdef __x86_64
+    uint32_t cpuidEax, cpuidEbx, cpuidEcx, cpuidEdx;
+    if (!__get_cpuid(0x80000007, &cpuidEax, &cpuidEbx, &cpuidEcx, &cpuidEdx) || !(cpuidEdx & (1UL << 8))) {
+        fprintf(stderr, "TSC isn't invariant, so it might not run at the same rate on every core\n");
+        return 0;
+    }
+
+    uint64_t startNs = GetNs(), startTicks = ReadTimestamp(), nowNs;
+    while ((nowNs = GetNs()) - startNs < 100000000ULL);
+    return (float)(ReadTimestamp() - startTicks) / (nowNs - startNs);
+#elif defined(__aarch64__)
+    // the generic timer's system wide by design
+    uint64_t frequency;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(frequency));
+    return frequency / 1e9f;
+#else
+    return 1.0f;
+#endif
+}
+
+int CompareInt64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// sorts one direction's samples and prints its distribution in ns, along with the range the
+// receiver's counter offset could be in. subtracting that range from a column gives the true bounds
+void PrintOneWay(int from, int to, int64_t *deltas, uint64_t samples, float ticksPerNs, int64_t minSkew, int64_t maxSkew) {
+    qsort(deltas, samples, sizeof(int64_t), CompareInt64);
+    printf("%d,%d,%f,%f,%f,%f,%f,%f,%f\n", from, to, deltas[0] / ticksPerNs, deltas[samples / 2] / ticksPerNs,
+        deltas[(samples - 1) * 9 / 10] / ticksPerNs, deltas[(samples - 1) * 99 / 100] / ticksPerNs, deltas[samples - 1] / ticksPerNs,
+        minSkew / ticksPerNs, maxSkew / ticksPerNs);
+}
+
+/// <summary>
+/// Measures one way latency in each direction for every pair of CPUs, by comparing the sender's
+/// timestamp with the receiver's. That only works if timestamps agree across cores, so each pair's
+/// skew is bounded first: a message can't arrive before it's sent, so the receiver's counter can't be
+/// ahead by more than the fastest message in one direction, or behind by more than the fastest
+/// in the other. Those bounds are printed with each row, since the one way times are only exact
+/// to within them. Pairs whose bounds contradict each other (a negative one way time) aren't printed
+/// </summary>
+void RunOneWayTest(CorePool *pool, int numProcs, uint64_t samples) {
+    float ticksPerNs = GetTimestampFrequency();
+    if (ticksPerNs == 0) {
+        fprintf(stderr, "Timestamps can't be compared across cores, so one way latency can't be measured\n");
+        return;
+    }
+
+    uint64_t *line = (uint64_t *)aligned_alloc(64, 64);
+    OneWayThreadData *threadData = (OneWayThreadData *)aligned_alloc(64, 2 * sizeof(OneWayThreadData));
+    int64_t *deltas = (int64_t *)malloc(2 * samples * sizeof(int64_t));
+    fprintf(stderr, "Timestamp counter at %f GHz\n", ticksPerNs);
+
+    printf("From,To,Min (ns),Median (ns),P90 (ns),P99 (ns),Max (ns),Min receiver skew (ns),Max receiver skew (ns)\n");
+    for (int i = 0; i < numProcs; i++) {
+        for (int j = i + 1; j < numProcs; j++) {
+            *line = 0;
+            for (int t = 0; t < 2; t++) {
+                threadData[t].line = line;
+                threadData[t].samples = samples;
+                threadData[t].sendFirst = t == 0;
+                threadData[t].deltas = deltas + t * samples;
+            }
+
+            // thread 1 on j receives i -> j messages, thread 0 on i receives j -> i ones
+            AssignWorker(pool, i, OneWayThread, threadData);
+            AssignWorker(pool, j, OneWayThread, threadData + 1);
+            RunAssignedTests(pool);
+
+            int64_t minForward = deltas[samples], minBack = deltas[0];
+            for (uint64_t s = 0; s < samples; s++) {
+                if (deltas[samples + s] < minForward) minForward = deltas[samples + s];
+                if (deltas[s] < minBack) minBack = deltas[s];
+            }
+
+            // with j's counter offset by skew from i's, forward deltas are latency + skew and back ones are latency - skew
+            fprintf(stderr, "%d to %d: %d's timestamps are between %f ns behind and %f ns ahead of %d's\n",
+                i, j, j, minBack / ticksPerNs, minForward / ticksPerNs, i);
+            if (minForward < 0 || minBack < 0) {
+                fprintf(stderr, "%d to %d: timestamps aren't synchronized, skipping the pair\n", i, j);
+                continue;
+            }
+
+            PrintOneWay(i, j, deltas + samples, samples, ticksPerNs, -minBack, minForward);
+            PrintOneWay(j, i, deltas, samples, ticksPerNs, -minForward, minBack);
+            fflush(stdout);
+        }
+    }
+
+    free(deltas);
+    free(threadData);
+    free(line);
+}
+
+/// <summary>
+/// Works out how close two CPUs are from sysfs topology
+/// </summary>
+/// <returns>index into placement_names</returns>
+int GetPlacementClass(int cpu1, int cpu2) {
+    if (SysfsListContains("/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu1, cpu2)) return 0;
+    if (SharesL3(cpu1, cpu2)) return 1;
+    if (ReadSysfsInt("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu1) ==
+        ReadSysfsInt("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu2)) return 2;
+    return 3;
+}
+
+// finds the group's representative for the topology union-find
+int FindGroup(int *parent, int cpu) {
+    while (parent[cpu] != cpu) cpu = parent[cpu] = parent[parent[cpu]];
+    return cpu;
+}
+
+// returns 1 if two CPU -> group labelings split CPUs up the same way
+int GroupingsMatch(int *groups1, int *groups2, int numProcs) {
+    for (int i = 0; i < numProcs; i++)
+        for (int j = i + 1; j < numProcs; j++)
+            if ((groups1[i] == groups1[j]) != (groups2[i] == groups2[j])) return 0;
+    return 1;
+}
+
+/// <summary>
+/// Labels each CPU with the lowest CPU in its sysfs list
+/// </summary>
+/// <returns>1 if every CPU's list could be read</returns>
+int GetSysfsGrouping(const char *pathFormat, int numProcs, int *groups) {
+    char path[256];
+    for (int cpu = 0; cpu < numProcs; cpu++) {
+        int count;
+        snprintf(path, sizeof(path), pathFormat, cpu);
+        int *list = ReadSysfsList(path, &count);
+        groups[cpu] = list != NULL && count > 0 ? list[0] : -1;
+        free(list);
+        if (groups[cpu] == -1) return 0;
+    }
+
+    return 1;
+}
+
+/// <summary>
+/// Groups CPUs by latency and compares the groups with sysfs topology. Clusters the symmetrized
+/// matrix bottom up with average linkage, then looks for big jumps between consecutive merge
+/// latencies. Each jump marks a topology level (SMT, cluster/CCX, die, socket), and cutting
+/// there gives that level's groups
+/// </summary>
+/// <param name="latencies">matrix as measured, before dividing by 2</param>
+void InferTopology(float *latencies, int numProcs) {
+    if (numProcs < 3) {
+        fprintf(stderr, "Need at least 3 CPUs to infer topology\n");
+        return;
+    }
+
+    const char *sysfsNames[] = { "SMT siblings", "cluster", "L3", "die", "package" };
+    const char *sysfsPaths[] = { "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+        "/sys/devices/system/cpu/cpu%d/topology/cluster_cpus_list", NULL,
+        "/sys/devices/system/cpu/cpu%d/topology/die_cpus_list",
+        "/sys/devices/system/cpu/cpu%d/topology/package_cpus_list" };
+    int sysfsCount = sizeof(sysfsNames) / sizeof(sysfsNames[0]);
+    float *distances = (float *)malloc(numProcs * numProcs * sizeof(float));
+    float *mergeLatencies = (float *)malloc(numProcs * sizeof(float));
+    int *mergeA = (int *)malloc(numProcs * sizeof(int)), *mergeB = (int *)malloc(numProcs * sizeof(int));
+    int *sizes = (int *)malloc(numProcs * sizeof(int)), *parent = (int *)malloc(numProcs * sizeof(int));
+    int *groups = (int *)malloc(numProcs * sizeof(int)), *sysfsGroups = (int *)malloc(sysfsCount * numProcs * sizeof(int));
+    int *sysfsAvailable = (int *)malloc(sysfsCount * sizeof(int)), *sysfsMatched = (int *)calloc(sysfsCount, sizeof(int));
+    char l3Path[256];
+    int merges, levels = 0;
+
+    // halve like the printed matrix, and average both directions
+    for (int i = 0; i < numProcs; i++) {
+        sizes[i] = 1;
+        for (int j = 0; j < numProcs; j++)
+            distances[j + i * numProcs] = (latencies[j + i * numProcs] + latencies[i + j * numProcs]) / 4;
+    }
+
+    // a cluster is named by its lowest CPU. sizes[i] == 0 once cluster i's been merged into another
+    for (merges = 0; merges < numProcs - 1; merges++) {
+        int a = -1, b = -1;
+        for (int i = 0; i < numProcs; i++) {
+            if (sizes[i] == 0) continue;
+            for (int j = i + 1; j < numProcs; j++) {
+                if (sizes[j] == 0) continue;
+                if (a == -1 || distances[j + i * numProcs] < distances[b + a * numProcs]) {
+                    a = i;
+                    b = j;
+                }
+            }
+        }
+
+        mergeA[merges] = a;
+        mergeB[merges] = b;
+        mergeLatencies[merges] = distances[b + a * numProcs];
+        for (int k = 0; k < numProcs; k++) {
+            if (sizes[k] == 0 || k == a || k == b) continue;
+            float combined = (distances[k + a * numProcs] * sizes[a] + distances[k + b * numProcs] * sizes[b]) / (sizes[a] + sizes[b]);
+            distances[k + a * numProcs] = distances[a + k * numProcs] = combined;
+        }
+
+        sizes[a] += sizes[b];
+        sizes[b] = 0;
+    }
+
+    // average linkage never merges below an earlier merge, so merge latencies are already sorted
+    for (int s = 0; s < sysfsCount; s++) {
+        const char *path = sysfsPaths[s];
+        if (path == NULL) {
+            int index = GetL3Index(0);
+            snprintf(l3Path, sizeof(l3Path), "/sys/devices/system/cpu/cpu%%d/cache/index%d/shared_cpu_list", index);
+            path = index == -1 ? NULL : l3Path;
+        }
+
+        sysfsAvailable[s] = path != NULL && GetSysfsGrouping(path, numProcs, sysfsGroups + s * numProcs);
+    }
+
+    fprintf(stderr, "Inferred topology:\n");
+    for (int m = 0; m < merges - 1; m++) {
+        float below = mergeLatencies[m], above = mergeLatencies[m + 1];
+        if (above < below * TOPOLOGY_GAP_RATIO || above - below < TOPOLOGY_MIN_GAP_NS) continue;
+
+        // everything that merged under the gap is one group at this level
+        float cutoff = (below + above) / 2;
+        int groupCount = numProcs, largest = 0;
+        for (int i = 0; i < numProcs; i++) parent[i] = i;
+        for (int k = 0; k < merges && mergeLatencies[k] <= cutoff; k++) {
+            parent[FindGroup(parent, mergeB[k])] = FindGroup(parent, mergeA[k]);
+            groupCount--;
+        }
+
+        for (int i = 0; i < numProcs; i++) groups[i] = FindGroup(parent, i);
+        levels++;
+        fprintf(stderr, "Level %d: under %f ns, %d groups:", levels, cutoff, groupCount);
+        for (int i = 0; i < numProcs; i++) {
+            if (groups[i] != i) continue;
+            int size = 0;
+            fprintf(stderr, " {");
+            for (int j = i; j < numProcs; j++) {
+                if (groups[j] != i) continue;
+                fprintf(stderr, size == 0 ? "%d" : ",%d", j);
+                size++;
+            }
+
+            fprintf(stderr, "}");
+            if (size > largest) largest = size;
+        }
+
+        fprintf(stderr, "\n");
+        int matched = 0;
+        for (int s = 0; s < sysfsCount; s++) {
+            if (!sysfsAvailable[s] || !GroupingsMatch(groups, sysfsGroups + s * numProcs, numProcs)) continue;
+            fprintf(stderr, "  matches sysfs %s\n", sysfsNames[s]);
+            sysfsMatched[s] = 1;
+            matched = 1;
+        }
+
+        if (!matched) fprintf(stderr, "  no sysfs match%s\n", levels == 1 && largest == 2 ? ", but looks like SMT pairs" : "");
+    }
+
+    if (levels == 0) fprintf(stderr, "No gaps in the latencies, so no topology levels found\n");
+
+    // only complain about sysfs levels that actually split CPUs up
+    for (int s = 0; s < sysfsCount; s++) {
+        if (!sysfsAvailable[s] || sysfsMatched[s]) continue;
+        int trivial = 1;
+        for (int i = 1; i < numProcs; i++) if (sysfsGroups[s * numProcs + i] != sysfsGroups[s * numProcs]) trivial = 0;
+
+        int singletons = 1;
+        for (int i = 0; i < numProcs; i++) if (sysfsGroups[s * numProcs + i] != i) singletons = 0;
+        if (trivial || singletons) continue;
+        fprintf(stderr, "sysfs %s groups don't show up in the latencies\n", sysfsNames[s]);
+    }
+
+    free(sysfsMatched);
+    free(sysfsAvailable);
+    free(sysfsGroups);
+    free(groups);
+    free(parent);
+    free(sizes);
+    free(mergeB);
+    free(mergeA);
+    free(mergeLatencies);
+    free(distances);
+}
+
+/// <summary>
+/// For each placement class relative to CPU 0, runs every queue type with CPU 0 as the consumer.
+/// SPSC types use the first CPU in the class as the producer, and MPSC uses up to
+/// MPSC_MAX_PRODUCERS CPUs from it. Reports message rate, and round trip latency with one
+/// message in flight and a second ring carrying the echo back
+/// </summary>
+void RunQueueTest(CorePool *pool, int numProcs, uint64_t messages) {
+    MessageRing *ring = (MessageRing *)aligned_alloc(64, sizeof(MessageRing));
+    MessageRing *replyRing = (MessageRing *)aligned_alloc(64, sizeof(MessageRing));
+    QueueThreadData *queueData = (QueueThreadData *)aligned_alloc(64, (MPSC_MAX_PRODUCERS + 1) * sizeof(QueueThreadData));
+    int placementCount = sizeof(placement_names) / sizeof(placement_names[0]), queueCount = sizeof(queue_names) / sizeof(queue_names[0]);
+    uint64_t roundTrips = messages / 10 > 0 ? messages / 10 : 1;
+
+    printf("Placement,Producer CPUs,Queue,Messages/s (M),Round trip (ns)\n");
+    for (int placement = 0; placement < placementCount; placement++) {
+        int producers[MPSC_MAX_PRODUCERS], producerCount = 0;
+        for (int cpu = 1; cpu < numProcs && producerCount < MPSC_MAX_PRODUCERS; cpu++)
+            if (GetPlacementClass(0, cpu) == placement) producers[producerCount++] = cpu;
+
+        if (producerCount == 0) {
+            fprintf(stderr, "No CPUs are %s to CPU 0\n", placement_names[placement]);
+            continue;
+        }
+
+        for (int kind = 0; kind < queueCount; kind++) {
+            int threads = kind == QUEUE_MPSC ? producerCount : 1;
+            uint64_t perProducer = messages / threads, expectedSum = 0;
+            InitMessageRing(ring);
+            memset(queueData, 0, (threads + 1) * sizeof(QueueThreadData));
+            for (int t = 0; t <= threads; t++) {
+                queueData[t].ring = ring;
+                queueData[t].kind = kind;
+            }
+
+            queueData[threads].messages = perProducer * threads;
+            AssignWorker(pool, 0, QueueConsumerThread, queueData + threads);
+            for (int t = 0; t < threads; t++) {
+                queueData[t].messages = perProducer;
+                queueData[t].firstValue = 1 + t * perProducer;
+                AssignWorker(pool, producers[t], QueueProducerThread, queueData + t);
+            }
+
+            RunAssignedTests(pool);
+            for (uint64_t value = 1; value <= perProducer * threads; value++) expectedSum += value;
+            if (queueData[threads].sum != expectedSum) fprintf(stderr, "%s lost messages\n", queue_names[kind]);
+
+            uint64_t startNs = queueData[threads].startNs, endNs = queueData[threads].endNs;
+            for (int t = 0; t < threads; t++) if (queueData[t].startNs < startNs) startNs = queueData[t].startNs;
+            float rate = 1000.0f * perProducer * threads / (endNs - startNs);
+
+            // batching doesn't apply with one message in flight
+            float roundTrip = 0;
+            if (kind != QUEUE_SPSC_BATCH) {
+                InitMessageRing(ring);
+                InitMessageRing(replyRing);
+                for (int t = 0; t < 2; t++) {
+                    queueData[t].ring = ring;
+                    queueData[t].replyRing = replyRing;
+                    queueData[t].kind = kind;
+                    queueData[t].messages = roundTrips;
+                }
+
+                AssignWorker(pool, 0, QueuePingThread, queueData);
+                AssignWorker(pool, producers[0], QueueEchoThread, queueData + 1);
+                RunAssignedTests(pool);
+                roundTrip = (float)(queueData[0].endNs - queueData[0].startNs) / roundTrips;
+            }
+
+            fprintf(stderr, "%s, %s, %d producers: %f M messages/s, %f ns round trip\n", placement_names[placement], queue_names[kind], threads, rate, roundTrip);
+            printf("%s,%d", placement_names[placement], producers[0]);
+            for (int t = 1; t < threads; t++) printf(" %d", producers[t]);
+            if (kind == QUEUE_SPSC_BATCH) printf(",%s,%f,x\n", queue_names[kind], rate);
+            else printf(",%s,%f,%f\n", queue_names[kind], rate, roundTrip);
+            fflush(stdout);
+        }
+    }
+
+    free(queueData);
+    free(replyRing);
+    free(ring);
+}
+
+/// <summary>
+/// Runs every atomic op and memory order combination. Uncontended cost comes from CPU 0 doing
+/// all the handoffs itself on a private line. Handoff latency is against the first CPU in each
+/// placement class relative to CPU 0, and is half a round trip like the core to core matrix
+/// </summary>
+void RunAtomicsTest(CorePool *pool, int numProcs, uint64_t iter) {
+    int placementCount = sizeof(placement_names) / sizeof(placement_names[0]);
+    int variantCount = sizeof(atomicVariants) / sizeof(AtomicVariant);
+    int *partners = (int *)malloc(placementCount * sizeof(int));
+    uint64_t *buffer = (uint64_t *)aligned_alloc(64, 64);
+    LatencyData uncontendedData;
+
+    printf("Op,Order,Uncontended (ns)");
+    for (int placement = 0; placement < placementCount; placement++) {
+        partners[placement] = -1;
+        for (int cpu = 1; cpu < numProcs && partners[placement] == -1; cpu++)
+            if (GetPlacementClass(0, cpu) == placement) partners[placement] = cpu;
+        if (partners[placement] != -1) printf(",%s (CPU %d) handoff (ns)", placement_names[placement], partners[placement]);
+    }
+
+    printf("\n");
+    for (int i = 0; i < variantCount; i++) {
+        AtomicVariant *variant = atomicVariants + i;
+        if (!variant->supported()) {
+            fprintf(stderr, "%s is not supported on this CPU\n", variant->op);
+            continue;
+        }
+
+        memset(buffer, 0, 64);
+        memset(&uncontendedData, 0, sizeof(LatencyData));
+        uncontendedData.target = buffer;
+        uncontendedData.iterations = iter;
+        AssignWorker(pool, 0, variant->uncontendedFunc, &uncontendedData);
+        RunAssignedTests(pool);
+        float uncontended = (float)(uncontendedData.endNs - uncontendedData.firstNs) / iter;
+        fprintf(stderr, "%s %s: %f ns uncontended\n", variant->op, variant->order, uncontended);
+        printf("%s,%s,%f", variant->op, variant->order, uncontended);
+
+        for (int placement = 0; placement < placementCount; placement++) {
+            if (partners[placement] == -1) continue;
+            printf(",%f", RunTest(pool, 0, partners[placement], iter, variant->bounceFunc) / 2);
+        }
+
+        printf("\n");
+        fflush(stdout);
+    }
+
+    free(buffer);
+    free(partners);
+}
+
+/// <summary>
+/// Gets one MESI scenario's per-line latency. Each round flushes the chase lines out of every cache,
+/// lets the prep CPUs put the lines into the state being tested, then times the measuring CPU
+/// going through them
+/// </summary>
+/// <param name="prepCpus">CPUs that set up line state, all at once</param>
+/// <param name="prepFunc">what the prep CPUs do, read (E/S) or write (M)</param>
+/// <param name="measureFunc">what the measuring CPU does, read or read-for-ownership</param>
+/// <returns>ns per line, best of rounds</returns>
+float RunMesiScenario(CorePool *pool, MesiThreadData *threadData, void **chase, void **lines, int *prepCpus, int prepCount,
+    WorkerFunc prepFunc, int measureCpu, WorkerFunc measureFunc, uint64_t rounds) {
+    float best = -1;
+    for (uint64_t round = 0; round < rounds; round++) {
+        for (int i = 0; i < MESI_LINES; i++) FlushLine(lines[i]);
+        FlushFence();
+
+        for (int i = 0; i < prepCount; i++) {
+            threadData[i].start = chase;
+            AssignWorker(pool, prepCpus[i], prepFunc, threadData + i);
+        }
+
+        RunAssignedTests(pool);
+
+        threadData[0].start = chase;
+        AssignWorker(pool, measureCpu, measureFunc, threadData);
+        RunAssignedTests(pool);
+        float latency = (float)threadData[0].elapsedNs / MESI_LINES;
+        if (best < 0 || latency < best) best = latency;
+    }
+
+    return best;
+}
+
+/// <summary>
+/// Measures coherency protocol transitions with a pointer chase over lines in a known state.
+/// modified and exclusive are core x core, with rows for the CPU holding the lines and columns for
+/// the one reading them. shared and invalidate are core x K, where the first K other CPUs read
+/// the lines, then the row's CPU either reads them too or takes ownership. With K = 1 the lines
+/// start out exclusive in that one sharer
+/// </summary>
+void RunMesiTest(CorePool *pool, int numProcs, uint64_t rounds, int scenario, int maxSharers) {
+    char *buffer = (char *)aligned_alloc(4096, MESI_LINES * CONTENTION_LINE_BYTES);
+    void **lines[MESI_LINES];
+    int *cpus = (int *)malloc(numProcs * sizeof(int));
+    MesiThreadData *threadData = (MesiThreadData *)aligned_alloc(64, numProcs * sizeof(MesiThreadData));
+    int scenarioCount = sizeof(mesi_scenarios) / sizeof(mesi_scenarios[0]);
+
+    // shuffled chase so prefetchers can't guess the next line
+    for (int i = 0; i < MESI_LINES; i++) lines[i] = (void **)(buffer + i * CONTENTION_LINE_BYTES);
+    for (int i = MESI_LINES - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        void **tmp = lines[i];
+        lines[i] = lines[j];
+        lines[j] = tmp;
+    }
+
+    for (int i = 0; i < MESI_LINES; i++) lines[i][0] = lines[(i + 1) % MESI_LINES];
+    if (maxSharers > numProcs - 1) maxSharers = numProcs - 1;
+
+    for (int s = 0; s < scenarioCount; s++) {
+        if (scenario != -1 && scenario != s) continue;
+        printf("%s\n", mesi_scenarios[s]);
+        if (s < 2) {
+            // core x core
+            for (int i = 0; i < numProcs; i++) {
+                for (int j = 0; j < numProcs; j++) {
+                    if (j != 0) printf(",");
+                    if (i == j) {
+                        printf("x");
+                        continue;
+                    }
+
+                    float latency = RunMesiScenario(pool, threadData, lines[0], (void **)lines, &i, 1,
+                        s == 0 ? MesiWriteThread : MesiReadThread, j, MesiReadThread, rounds);
+                    fprintf(stderr, "%s: %d to %d: %f ns\n", mesi_scenarios[s], i, j, latency);
+                    printf("%f", latency);
+                }
+
+                printf("\n");
+            }
+        } else {
+            // core x sharer count
+            printf("CPU");
+            for (int k = 1; k <= maxSharers; k++) printf(",K=%d", k);
+            printf("\n");
+            for (int i = 0; i < numProcs; i++) {
+                printf("%d", i);
+                for (int k = 1; k <= maxSharers; k++) {
+                    int sharerCount = 0;
+                    for (int cpu = 0; cpu < numProcs && sharerCount < k; cpu++) if (cpu != i) cpus[sharerCount++] = cpu;
+                    float latency = RunMesiScenario(pool, threadData, lines[0], (void **)lines, cpus, sharerCount,
+                        MesiReadThread, i, s == 2 ? MesiReadThread : MesiRmwThread, rounds);
+                    fprintf(stderr, "%s: CPU %d with %d sharers: %f ns\n", mesi_scenarios[s], i, k, latency);
+                    printf(",%f", latency);
+                }
+
+                printf("\n");
+            }
+        }
+
+        fflush(stdout);
+    }
+
+    free(threadData);
+    free(cpus);
+    free(buffer);
+}
+
+// pins the calling thread. CPU_ALLOC sized sets so this works past CPU_SETSIZE (1024) CPUs
+int SetCurrentThreadAffinity(unsigned int processor) {
+    cpu_set_t *cpuset = CPU_ALLOC(processor + 1);
+    size_t cpusetSize = CPU_ALLOC_SIZE(processor + 1);
+    CPU_ZERO_S(cpusetSize, cpuset);
+    CPU_SET_S(processor, cpusetSize, cpuset);
+    int rc = sched_setaffinity(gettid(), cpusetSize, cpuset);
+    if (rc != 0) fprintf(stderr, "thread %ld could not set affinity to %u\n", gettid(), processor);
+    CPU_FREE(cpuset);
+    return rc;
+}
+
+void ReadLatencyTestThread(void *param) {
     LatencyData *latencyData = (LatencyData *)param;
-    cpu_set_t cpuset;
     uint64_t current = latencyData->start;
-    
-    CPU_ZERO(&cpuset);
-    CPU_SET(latencyData->processorIndex, &cpuset);
-    sched_setaffinity(gettid(), sizeof(cpu_set_t), &cpuset);
-    //fprintf(stderr, "thread %ld set affinity %d\n", gettid(), latencyData->processorIndex);
-    
+    while (__atomic_load_n(latencyData->readTarget, __ATOMIC_ACQUIRE) != current - 1);
+    latencyData->firstNs = GetNs();
+    __atomic_store_n(latencyData->target, current, __ATOMIC_RELEASE);
+    current += 2;
     while (current <= 2 * latencyData->iterations) {
-        if (__sync_bool_compare_and_swap(latencyData->target, current - 1, current)) current += 2;
+        if (__atomic_load_n(latencyData->readTarget, __ATOMIC_ACQUIRE) == current - 1) {
+            __atomic_store_n(latencyData->target, current, __ATOMIC_RELEASE);
+            current += 2;
+        }
     }
 
-    pthread_exit(NULL);
+    latencyData->endNs = GetNs();
 }
@@ -1,6 +1,8 @@
 // MemoryBandwidth.c : Version for linux (x86 and ARM)
 // Mostly the same as the x86-only VS version, but a bit more manual
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -11,11 +13,22 @@
 #endif
 
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include <sched.h>
 #include <pthread.h>
 #include <math.h>
 
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <linux/io_uring.h>
+#endif
+
 // make mingw happy
 #ifdef __MINGW32__
 #define aligned_alloc(align, size) _aligned_malloc(size, align)
@@ -25,15 +38,125 @@ int default_test_sizes[39] = { 2, 4, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 25
                                3072, 4096, 5120, 6144, 8192, 10240, 12288, 16384, 24567, 32768, 65536, 98304,
                                131072, 262144, 393216, 524288, 1048576, 1572864, 2097152, 3145728 };
 
+int *test_sizes = default_test_sizes;
+int test_size_count = sizeof(default_test_sizes) / sizeof(int);
+
 typedef struct BandwidthTestThreadData {
     uint64_t iterations;
     uint64_t arr_length;
     uint64_t start;
     float* arr;
     float bw; // written to by the thread
+    volatile uint64_t *progress; // if not NULL, bytes read are added here as the test goes
 } BandwidthTestThreadData;
 
-float MeasureBw(uint64_t sizeKb, uint64_t iterations, uint64_t threads, int shared);
+// sampled runs read at most this much per bw_func call (1 MB), so progress shows up often enough
+#define SAMPLED_CHUNK_ELEMENTS (256 * 1024)
+
+// per-thread progress counter, on its own cache line so the monitor doesn't cause false sharing
+typedef struct BandwidthProgressCounter {
+    volatile uint64_t bytes;
+    char pad[56];
+} BandwidthProgressCounter;
+
+// Monitor thread state for sampled runs. Records time and every thread's
+// byte count at each interval
+typedef struct BandwidthMonitorData {
+    BandwidthProgressCounter *counters;
+    uint64_t threads;
+    uint64_t intervalUs;
+    volatile int done;
+    uint64_t sampleCount;
+    uint64_t sampleCapacity;
+    uint64_t *sampleTimesNs;
+    uint64_t *sampleBytes; // sampleCount rows of 'threads' counts
+} BandwidthMonitorData;
+
+// Worker threads that stick around between measurements, so sweeps don't
+// pay for thread creation on every run. Each job is started and finished
+// with a barrier. Workers past 'active' just wait out the job
+typedef struct BandwidthThreadPool {
+    uint64_t threads;
+    uint64_t active;
+    pthread_t *handles;
+    struct BandwidthPoolWorker *workers;
+    pthread_barrier_t startBarrier;
+    pthread_barrier_t endBarrier;
+    void *(*job)(void *);  // called with jobData + worker index * jobDataStride
+    char *jobData;
+    size_t jobDataStride;
+    int quit;
+} BandwidthThreadPool;
+
+typedef struct BandwidthPoolWorker {
+    BandwidthThreadPool *pool;
+    uint64_t index;
+} BandwidthPoolWorker;
+
+// memory placement for test arrays. Anything >= 0 binds to that NUMA node
+#define NUMA_NODE_ANY -1
+#define NUMA_NODE_INTERLEAVE -2
+
+// what backs test arrays. PAGES_DEFAULT is plain aligned_alloc
+#define PAGES_DEFAULT 0
+#define PAGES_4K 1
+#define PAGES_THP 2
+#define PAGES_2M 3
+#define PAGES_1G 4
+
+#ifdef __linux__
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+#endif
+
+int page_mode = PAGES_DEFAULT;
+
+// Test arrays, allocated once for the largest test size. Smaller tests just use
+// the start of each array. In shared mode there's a single array read by everyone,
+// otherwise each thread gets its own
+typedef struct BandwidthTestBuffers {
+    int shared;
+    int memNode;
+    uint64_t count;
+    uint64_t *elements; // capacity of each array, in floats
+    uint64_t *mappedBytes; // length of each mmap-ed array, 0 if it came from aligned_alloc
+    float **arrs;
+} BandwidthTestBuffers;
+
+// start..end inclusive, parsed from "start..end[:step]" or just "n"
+typedef struct SweepRange {
+    uint64_t start;
+    uint64_t end;
+    uint64_t step;
+} SweepRange;
+
+float MeasureBw(BandwidthThreadPool *pool, BandwidthTestBuffers *buffers, uint64_t sizeKb, uint64_t iterations, uint64_t threads, uint64_t sampleIntervalUs);
+void *BandwidthMonitorThread(void *param);
+void PrintBandwidthSamples(BandwidthMonitorData *monitor, uint64_t sizeKb);
+int ParseTestSizes(const char *str);
+int AllocateTestBuffers(BandwidthThreadPool *pool, BandwidthTestBuffers *buffers, uint64_t sizeKb, uint64_t minThreads, uint64_t maxThreads, int shared, int memNode);
+uint64_t GetMaxTestSize();
+void FreeTestBuffers(BandwidthTestBuffers *buffers);
+float *AllocateTestArray(uint64_t bytes, int memNode, uint64_t *mappedBytes);
+void FreeTestArray(float *arr, uint64_t mappedBytes);
+void ReportPageBacking(BandwidthTestBuffers *buffers);
+void RunThreadSweep(BandwidthThreadPool *pool, SweepRange *range, int shared);
+void RunNumaMatrix(BandwidthThreadPool *pool, SweepRange *range, uint64_t sizeKb, int shared);
+void RunCoreToCoreTest(BandwidthThreadPool *pool, int cpuStride);
+void RunFileIoTest(const char *path, uint64_t fileSizeMb, uint32_t queueDepth);
+void RunCopyTest(BandwidthThreadPool *pool, SweepRange *range, uint64_t sizeMb);
+void RunInstructionFetchTest(BandwidthThreadPool *pool, uint64_t threads);
+int ParseSweepRange(const char *str, SweepRange *range);
+int CreateThreadPool(BandwidthThreadPool *pool, uint64_t threads);
+uint64_t RunPoolJob(BandwidthThreadPool *pool, uint64_t active, void *(*job)(void *), void *jobData, size_t jobDataStride);
+void DestroyThreadPool(BandwidthThreadPool *pool);
 
 
 #ifdef __x86_64
@@ -42,13 +165,106 @@ float scalar_read(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t
 extern float asm_read(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) __attribute__((ms_abi));
 extern float sse_read(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) __attribute__((ms_abi));
 extern float avx512_read(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) __attribute__((ms_abi));
+extern float asm_read_pft0(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) __attribute__((ms_abi));
+extern float asm_read_pft2(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) __attribute__((ms_abi));
+extern float asm_read_pfnta(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) __attribute__((ms_abi));
+extern float avx512_read_pft0(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) __attribute__((ms_abi));
+extern float avx512_read_pft2(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) __attribute__((ms_abi));
+extern float avx512_read_pfnta(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) __attribute__((ms_abi));
+extern void clflush_lines(void *ptr, uint64_t bytes) __attribute__((ms_abi));
+extern void clflushopt_lines(void *ptr, uint64_t bytes) __attribute__((ms_abi));
+extern void clwb_lines(void *ptr, uint64_t bytes) __attribute__((ms_abi));
 float (*bw_func)(float*, uint64_t, uint64_t, uint64_t start) __attribute__((ms_abi)); 
+typedef float (__attribute__((ms_abi)) *BwFunc)(float*, uint64_t, uint64_t, uint64_t start);
+
+// software prefetch variants of asm_read, and of avx512_read if that's what's being used
+const char *prefetch_names[] = { "t0", "t2", "nta" };
+BwFunc prefetch_funcs[] = { asm_read_pft0, asm_read_pft2, asm_read_pfnta };
+BwFunc prefetch512_funcs[] = { avx512_read_pft0, avx512_read_pft2, avx512_read_pfnta };
+
+typedef void (__attribute__((ms_abi)) *FlushFunc)(void *, uint64_t);
+const char *flush_names[] = { "clflush", "clflushopt", "clwb" };
+FlushFunc flush_funcs[] = { clflush_lines, clflushopt_lines, clwb_lines };
+
+extern void copy_regular(void *dst, void *src, uint64_t bytes) __attribute__((ms_abi));
+extern void copy_nt(void *dst, void *src, uint64_t bytes) __attribute__((ms_abi));
+typedef void (__attribute__((ms_abi)) *CopyFunc)(void *, void *, uint64_t);
 #else
 float scalar_read(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start);
 extern float asm_read(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start);
+extern float asm_read_pfl1keep(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start);
+extern float asm_read_pfl2strm(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start);
+extern void dc_cvac_lines(void *ptr, uint64_t bytes);
+extern void dc_civac_lines(void *ptr, uint64_t bytes);
 float (*bw_func)(float*, uint64_t, uint64_t, uint64_t start); 
+typedef float (*BwFunc)(float*, uint64_t, uint64_t, uint64_t start);
+
+const char *prefetch_names[] = { "l1keep", "l2strm" };
+BwFunc prefetch_funcs[] = { asm_read_pfl1keep, asm_read_pfl2strm };
+
+typedef void (*FlushFunc)(void *, uint64_t);
+const char *flush_names[] = { "dc cvac", "dc civac" };
+FlushFunc flush_funcs[] = { dc_cvac_lines, dc_civac_lines };
+
+extern void copy_regular(void *dst, void *src, uint64_t bytes);
+extern void copy_nt(void *dst, void *src, uint64_t bytes);
+typedef void (*CopyFunc)(void *, void *, uint64_t);
 #endif
 
+// how far ahead the prefetch kernels prefetch, in bytes. read by the asm
+uint64_t prefetch_distance = 512;
+uint64_t prefetch_sweep_distances[] = { 0, 64, 128, 256, 512, 1024, 2048, 3072, 4096 };
+
+// random access (GUPS) updates per thread, and the HPCC RandomAccess LFSR polynomial
+#define GUPS_UPDATES_PER_THREAD (1ULL << 26)
+#define GUPS_POLY 0x7ULL
+
+typedef struct GupsThreadData {
+    uint64_t *table;
+    uint64_t tableLength;
+    uint64_t updates;
+    uint64_t seed;
+} GupsThreadData;
+
+float MeasureGups(BandwidthThreadPool *pool, BandwidthTestBuffers *buffers, uint64_t sizeKb, uint64_t threads, int atomic);
+void RunGupsTest(BandwidthThreadPool *pool, uint64_t threads, int shared);
+typedef struct StreamReadThreadData {
+    char *arr;
+    uint64_t streamCount;
+    uint64_t streamBytes;
+    uint64_t iterations;
+} StreamReadThreadData;
+
+float MeasureStreamBw(BandwidthThreadPool *pool, BandwidthTestBuffers *buffers, uint64_t sizeKb, uint64_t streamCount);
+void RunStreamCountTest(BandwidthThreadPool *pool, SweepRange *range);
+// for cold cache tests without a cache flush instruction, walk this much memory to evict the test array
+#define COLD_EVICT_BYTES (256ULL * 1024 * 1024)
+
+typedef struct ColdReadThreadData {
+    float *arr;
+    uint64_t arr_length;
+    uint64_t reps;
+    int flush;           // flush the array before each pass. otherwise, it's the hot baseline
+    char *evictBuffer;   // used instead of flush instructions if set
+    uint64_t readTimeNs; // written by the thread
+} ColdReadThreadData;
+
+void RunColdCacheTest(BandwidthThreadPool *pool, uint64_t threads);
+
+typedef struct FlushThreadData {
+    float *arr;
+    uint64_t arr_length;
+    uint64_t reps;
+    FlushFunc flushFunc;
+    int dirty;            // write every line before flushing, instead of just reading it
+    uint64_t flushTimeNs; // written by the thread
+} FlushThreadData;
+
+void RunFlushTest(BandwidthThreadPool *pool, uint64_t threads);
+int SetPrefetchKernel(int hintIdx);
+void RunPrefetchSweep(BandwidthThreadPool *pool, uint64_t threads, int shared);
+void RunRwRatioTest(BandwidthThreadPool *pool, uint64_t threads, int shared);
+
 uint64_t GetIterationCount(uint64_t testSize, uint64_t threads);
 void *ReadBandwidthTestThread(void *param);
 
@@ -57,14 +273,140 @@ int main(int argc, char *argv[]) {
     int cpuid_data[4];
     int shared = 1;
     int methodSet = 0;
+    int numa = 0;
+    uint64_t numaSizeMb = 1024;
+    const char *pageModeNames[] = { "default", "4k", "thp", "2m", "1g" };
+    SweepRange threadSweep = { 0, 0, 0 }, streamSweep = { 0, 0, 0 };
+    BandwidthThreadPool pool;
+    BandwidthTestBuffers buffers;
+    uint64_t sampleIntervalUs = 0;
+    int prefetchHint = -1, prefetchSweep = 0, gups = 0, c2cStride = 0, cold = 0, flush = 0, rwRatio = 0, instr = 0;
+    const char *ioPath = NULL;
+    uint64_t ioFileSizeMb = 4096;
+    uint32_t ioQueueDepth = 32;
+    uint64_t copySizeMb = 0;
     bw_func = asm_read;
     for (int argIdx = 1; argIdx < argc; argIdx++) {
         if (*(argv[argIdx]) == '-') {
             char *arg = argv[argIdx] + 1;
-            if (strncmp(arg, "threads", 7) == 0) {
+            if (strncmp(arg, "threadsweep", 11) == 0) {
+                argIdx++;
+                if (argIdx >= argc || !ParseSweepRange(argv[argIdx], &threadSweep)) {
+                    fprintf(stderr, "Expected thread range like 1..16 or 1..64:4\n");
+                    return 0;
+                }
+
+                fprintf(stderr, "Sweeping %lu to %lu threads, step %lu\n", threadSweep.start, threadSweep.end, threadSweep.step);
+            } else if (strncmp(arg, "threads", 7) == 0) {
                 argIdx++;
                 threads = atoi(argv[argIdx]);
                 fprintf(stderr, "Using %d threads\n", threads);
+            } else if (strncmp(arg, "numasizemb", 10) == 0) {
+                argIdx++;
+                numaSizeMb = atol(argv[argIdx]);
+                fprintf(stderr, "Using %lu MB for NUMA tests\n", numaSizeMb);
+            } else if (strncmp(arg, "numa", 4) == 0) {
+                numa = 1;
+                fprintf(stderr, "Testing bandwidth between each pair of NUMA nodes\n");
+            } else if (strncmp(arg, "pages", 5) == 0) {
+                argIdx++;
+                page_mode = -1;
+                for (int modeIdx = 0; argIdx < argc && modeIdx < sizeof(pageModeNames) / sizeof(pageModeNames[0]); modeIdx++) {
+                    if (strcmp(argv[argIdx], pageModeNames[modeIdx]) == 0) page_mode = modeIdx;
+                }
+
+                if (page_mode < 0) {
+                    fprintf(stderr, "Expected page type: 4k, thp, 2m, or 1g\n");
+                    return 0;
+                }
+
+                fprintf(stderr, "Using %s pages for test arrays\n", pageModeNames[page_mode]);
+            } else if (strncmp(arg, "sample", 6) == 0) {
+                argIdx++;
+                sampleIntervalUs = argIdx < argc ? (uint64_t)(atof(argv[argIdx]) * 1000) : 0;
+                if (sampleIntervalUs == 0) {
+                    fprintf(stderr, "Expected sampling interval in ms\n");
+                    return 0;
+                }
+
+                fprintf(stderr, "Sampling bandwidth every %lu us\n", sampleIntervalUs);
+            } else if (strncmp(arg, "sizes", 5) == 0) {
+                argIdx++;
+                if (argIdx >= argc || !ParseTestSizes(argv[argIdx])) {
+                    fprintf(stderr, "Expected comma separated test sizes in KB\n");
+                    return 0;
+                }
+
+                fprintf(stderr, "Testing %d sizes\n", test_size_count);
+            } else if (strncmp(arg, "prefetchsweep", 13) == 0) {
+                prefetchSweep = 1;
+                fprintf(stderr, "Sweeping software prefetch distance\n");
+            } else if (strncmp(arg, "prefetchdist", 12) == 0) {
+                argIdx++;
+                prefetch_distance = atol(argv[argIdx]);
+                fprintf(stderr, "Prefetching %lu bytes ahead\n", prefetch_distance);
+            } else if (strncmp(arg, "prefetch", 8) == 0) {
+                argIdx++;
+                for (int hintIdx = 0; argIdx < argc && hintIdx < sizeof(prefetch_names) / sizeof(prefetch_names[0]); hintIdx++) {
+                    if (strcmp(argv[argIdx], prefetch_names[hintIdx]) == 0) prefetchHint = hintIdx;
+                }
+
+                if (prefetchHint < 0) {
+                    fprintf(stderr, "Unrecognized prefetch type\n");
+                    return 0;
+                }
+
+                fprintf(stderr, "Using software prefetch (%s)\n", prefetch_names[prefetchHint]);
+            } else if (strncmp(arg, "streams", 7) == 0) {
+                argIdx++;
+                if (argIdx >= argc || !ParseSweepRange(argv[argIdx], &streamSweep)) {
+                    fprintf(stderr, "Expected stream count range like 1..64\n");
+                    return 0;
+                }
+
+                fprintf(stderr, "Reading %lu to %lu interleaved streams from one thread\n", streamSweep.start, streamSweep.end);
+            } else if (strncmp(arg, "c2cstride", 9) == 0) {
+                argIdx++;
+                c2cStride = atoi(argv[argIdx]);
+                if (c2cStride < 1) c2cStride = 1;
+                fprintf(stderr, "Testing transfers between every %d CPUs\n", c2cStride);
+            } else if (strncmp(arg, "c2c", 3) == 0) {
+                if (c2cStride == 0) c2cStride = 1;
+                fprintf(stderr, "Testing core to core transfer bandwidth\n");
+            } else if (strncmp(arg, "instr", 5) == 0) {
+                instr = 1;
+                fprintf(stderr, "Testing instruction fetch bandwidth\n");
+            } else if (strncmp(arg, "copysizemb", 10) == 0) {
+                argIdx++;
+                copySizeMb = atoi(argv[argIdx]);
+                fprintf(stderr, "Copying %lu MB buffers\n", copySizeMb);
+            } else if (strncmp(arg, "copy", 4) == 0) {
+                if (copySizeMb == 0) copySizeMb = 2048;
+            } else if (strncmp(arg, "filesizemb", 10) == 0) {
+                argIdx++;
+                ioFileSizeMb = atoi(argv[argIdx]);
+                fprintf(stderr, "Creating a %lu MB file if the test file doesn't exist\n", ioFileSizeMb);
+            } else if (strncmp(arg, "file", 4) == 0) {
+                argIdx++;
+                ioPath = argv[argIdx];
+                fprintf(stderr, "Testing file reads from %s\n", ioPath);
+            } else if (strncmp(arg, "iodepth", 7) == 0) {
+                argIdx++;
+                ioQueueDepth = atoi(argv[argIdx]);
+                if (ioQueueDepth < 1) ioQueueDepth = 1;
+                fprintf(stderr, "io_uring queue depth: %u\n", ioQueueDepth);
+            } else if (strncmp(arg, "rwratio", 7) == 0) {
+                rwRatio = 1;
+                fprintf(stderr, "Testing mixed read/write ratios\n");
+            } else if (strncmp(arg, "flush", 5) == 0) {
+                flush = 1;
+                fprintf(stderr, "Measuring cache line flush/writeback throughput\n");
+            } else if (strncmp(arg, "cold", 4) == 0) {
+                cold = 1;
+                fprintf(stderr, "Flushing the test array before each pass\n");
+            } else if (strncmp(arg, "gups", 4) == 0) {
+                gups = 1;
+                fprintf(stderr, "Measuring random 8B read-modify-write updates (GUPS)\n");
             } else if (strncmp(arg, "shared", 6) == 0) {
                 shared = 1;
                 fprintf(stderr, "Using shared array\n");
@@ -94,7 +436,7 @@ int main(int argc, char *argv[]) {
             }
         } else {
             fprintf(stderr, "Expected - parameter\n");
-            fprintf(stderr, "Usage: [-threads <thread count>] [-private] [-method <scalar/asm/avx512>]\n");
+            fprintf(stderr, "Usage: [-threads <thread count>] [-threadsweep <start..end[:step]>] [-numa] [-numasizemb <MB>] [-pages <4k/thp/2m/1g>] [-sample <interval ms>] [-prefetch <t0/t2/nta or l1keep/l2strm>] [-prefetchdist <bytes>] [-prefetchsweep] [-gups] [-streams <start..end[:step]>] [-c2c] [-c2cstride <n>] [-cold] [-flush] [-rwratio] [-copy] [-copysizemb <MB>] [-instr] [-file <path>] [-filesizemb <MB>] [-iodepth <n>] [-sizes <KB,KB,...>] [-private] [-method <scalar/asm/avx512>]\n");
         }
     }
 
@@ -124,154 +466,2100 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
+    if (instr) {
+        if (!CreateThreadPool(&pool, threads)) return 0;
+        RunInstructionFetchTest(&pool, threads);
+        DestroyThreadPool(&pool);
+        return 0;
+    }
+
+    if (copySizeMb != 0) {
+        if (threadSweep.step == 0) {
+            threadSweep.start = threadSweep.step = 1;
+            threadSweep.end = threads;
+        }
+
+#ifdef __x86_64
+        if (!__builtin_cpu_supports("avx")) {
+            fprintf(stderr, "Copy kernels need AVX\n");
+            return 0;
+        }
+#endif
+        if (!CreateThreadPool(&pool, threadSweep.end)) return 0;
+        RunCopyTest(&pool, &threadSweep, copySizeMb);
+        DestroyThreadPool(&pool);
+        return 0;
+    }
+
+    if (ioPath != NULL) {
+        RunFileIoTest(ioPath, ioFileSizeMb, ioQueueDepth);
+        return 0;
+    }
+
+    if (flush) {
+        if (!CreateThreadPool(&pool, threads)) return 0;
+        RunFlushTest(&pool, threads);
+        DestroyThreadPool(&pool);
+        return 0;
+    }
+
+    if (cold) {
+        if (!CreateThreadPool(&pool, threads)) return 0;
+        RunColdCacheTest(&pool, threads);
+        DestroyThreadPool(&pool);
+        return 0;
+    }
+
+    if (c2cStride != 0) {
+        if (!CreateThreadPool(&pool, 2)) return 0;
+        RunCoreToCoreTest(&pool, c2cStride);
+        DestroyThreadPool(&pool);
+        return 0;
+    }
+
+    if (streamSweep.step != 0) {
+        if (!CreateThreadPool(&pool, 1)) return 0;
+        RunStreamCountTest(&pool, &streamSweep);
+        DestroyThreadPool(&pool);
+        return 0;
+    }
+
+    if (gups) {
+        if (!CreateThreadPool(&pool, threads)) return 0;
+        RunGupsTest(&pool, threads, shared);
+        DestroyThreadPool(&pool);
+        return 0;
+    }
+
+    if (rwRatio) {
+        if (!CreateThreadPool(&pool, threads)) return 0;
+        RunRwRatioTest(&pool, threads, shared);
+        DestroyThreadPool(&pool);
+        return 0;
+    }
+
+    if (prefetchSweep) {
+        if (!CreateThreadPool(&pool, threads)) return 0;
+        RunPrefetchSweep(&pool, threads, shared);
+        DestroyThreadPool(&pool);
+        return 0;
+    }
+
+    if (prefetchHint >= 0 && !SetPrefetchKernel(prefetchHint)) return 0;
+
+    if (numa) {
+        if (threadSweep.step == 0) threadSweep.start = threadSweep.end = threadSweep.step = threads;
+        if (!CreateThreadPool(&pool, threadSweep.end)) return 0;
+        RunNumaMatrix(&pool, &threadSweep, numaSizeMb * 1024, shared);
+        DestroyThreadPool(&pool);
+        return 0;
+    }
+
+    if (threadSweep.step != 0) {
+        if (!CreateThreadPool(&pool, threadSweep.end)) return 0;
+        RunThreadSweep(&pool, &threadSweep, shared);
+        DestroyThreadPool(&pool);
+        return 0;
+    }
+
+    if (!CreateThreadPool(&pool, threads)) return 0;
+    if (!AllocateTestBuffers(&pool, &buffers, GetMaxTestSize(), threads, threads, shared, NUMA_NODE_ANY)) return 0;
+    if (sampleIntervalUs != 0) {
+        printf("Region (KB),Time (ms),Total (GB/s)");
+        for (int i = 0; i < threads; i++) printf(",Thread %d (GB/s)", i);
+        printf("\n");
+        for (int i = 0; i < test_size_count; i++) {
+            float bw = MeasureBw(&pool, &buffers, test_sizes[i], GetIterationCount(test_sizes[i], threads), threads, sampleIntervalUs);
+            fprintf(stderr, "%d KB: %f GB/s average\n", test_sizes[i], bw);
+        }
+
+        FreeTestBuffers(&buffers);
+        DestroyThreadPool(&pool);
+        return 0;
+    }
+
     printf("Using %d threads\n", threads);
-    for (int i = 0; i < sizeof(default_test_sizes) / sizeof(int); i++)
+    for (int i = 0; i < test_size_count; i++)
     {
-        printf("%d,%f\n", default_test_sizes[i], MeasureBw(default_test_sizes[i], GetIterationCount(default_test_sizes[i], threads), threads, shared));
+        printf("%d,%f\n", test_sizes[i], MeasureBw(&pool, &buffers, test_sizes[i], GetIterationCount(test_sizes[i], threads), threads, 0));
     }
 
+    FreeTestBuffers(&buffers);
+    DestroyThreadPool(&pool);
     return 0;
 }
 
+uint64_t GetMaxTestSize() {
+    uint64_t maxSizeKb = 0;
+    for (int i = 0; i < test_size_count; i++)
+        if (test_sizes[i] > maxSizeKb) maxSizeKb = test_sizes[i];
+    return maxSizeKb;
+}
+
 /// <summary>
-/// Given test size in KB, return a good iteration count
+/// Replaces the default test sizes with a comma separated list of sizes in KB
 /// </summary>
-/// <param name="testSize">test size in KB</param>
-/// <returns>Iterations per thread</returns>
-uint64_t GetIterationCount(uint64_t testSize, uint64_t threads)
-{
-    uint64_t gbToTransfer = 512;
-    if (testSize > 64) gbToTransfer = 64;
-    if (testSize > 512) gbToTransfer = 32;
-    if (testSize > 8192) gbToTransfer = 16;
-    uint64_t iterations = gbToTransfer * 1024 * 1024 / testSize;
+/// <returns>1 if the list is usable, 0 otherwise</returns>
+int ParseTestSizes(const char *str) {
+    char *end;
+    int count = 1;
+    for (const char *c = str; *c != '\0'; c++) if (*c == ',') count++;
+    test_sizes = (int *)malloc(count * sizeof(int));
+    test_size_count = 0;
+    while (*str != '\0') {
+        int sizeKb = strtol(str, &end, 10);
+        if (end == str || sizeKb <= 0) return 0;
+        test_sizes[test_size_count++] = sizeKb;
+        str = (*end == ',') ? end + 1 : end;
+    }
 
-    if (iterations < 8) return 8; // set a minimum to reduce noise
-    else return iterations;
+    return test_size_count > 0;
 }
 
-float MeasureBw(uint64_t sizeKb, uint64_t iterations, uint64_t threads, int shared) {
-    struct timeval startTv, endTv;
-    struct timezone startTz, endTz;
-    float bw = 0;
-    uint64_t elements = sizeKb * 1024 / sizeof(float);
+/// <summary>
+/// Parses a range like "1..16", "2..64:2", or a single count like "8"
+/// </summary>
+/// <returns>1 if the range is usable, 0 otherwise</returns>
+int ParseSweepRange(const char *str, SweepRange *range) {
+    char *end;
+    range->start = strtoul(str, &end, 10);
+    range->end = range->start;
+    range->step = 1;
+    if (strncmp(end, "..", 2) == 0) {
+        range->end = strtoul(end + 2, &end, 10);
+    }
 
-    if (!shared && sizeKb < threads) {
-        fprintf(stderr, "Too many threads for this test size\n");
-        return 0;
+    if (*end == ':') {
+        range->step = strtoul(end + 1, &end, 10);
     }
 
-    // make sure this is divisble by 512 bytes, since the unrolled asm loop depends on that
-    // it's hard enough to get close to theoretical L1D BW as is, so we don't want additional cmovs or branches
-    // in the hot loop
-    uint64_t private_elements = (uint64_t)ceil(((double)sizeKb * 1024 / sizeof(float)) / (double)threads);
-    //fprintf(stderr, "Actual data: %lu KB\n", private_elements * 4 * threads / 1024);
+    if (*end != '\0' || range->start == 0 || range->end < range->start || range->step == 0) return 0;
+    return 1;
+}
 
-    // make array and fill it with something, if shared
-    float* testArr = NULL;
-    if (shared){ 
-        testArr = (float*)aligned_alloc(64, elements * sizeof(float));
-        if (testArr == NULL) {
-            fprintf(stderr, "Could not allocate memory\n");
-            return 0;
-        }
+/// <summary>
+/// Measures every thread count in the range for each test size, printing
+/// one row per size and one column per thread count. Buffers are
+/// filled once and shared by all sizes and thread counts
+/// </summary>
+void RunThreadSweep(BandwidthThreadPool *pool, SweepRange *range, int shared) {
+    BandwidthTestBuffers buffers;
+    int threadCounts = 0, rangeIdx = 0;
+    for (uint64_t threads = range->start; threads <= range->end; threads += range->step) threadCounts++;
+    float *results = (float *)calloc(threadCounts * test_size_count, sizeof(float));
 
-        for (uint64_t i = 0; i < elements; i++) {
-            testArr[i] = i + 0.5f;
+    // private arrays are allocated per thread count, so memory never goes past the largest test size
+    if (shared && !AllocateTestBuffers(pool, &buffers, GetMaxTestSize(), range->start, range->end, shared, NUMA_NODE_ANY)) {
+        free(results);
+        return;
+    }
+
+    for (uint64_t threads = range->start; threads <= range->end; threads += range->step, rangeIdx++) {
+        if (!shared && !AllocateTestBuffers(pool, &buffers, GetMaxTestSize(), threads, threads, shared, NUMA_NODE_ANY)) continue;
+        for (int i = 0; i < test_size_count; i++) {
+            uint64_t sizeKb = test_sizes[i];
+            float bw = MeasureBw(pool, &buffers, sizeKb, GetIterationCount(sizeKb, threads), threads, 0);
+            fprintf(stderr, "%lu KB, %lu threads: %f GB/s\n", sizeKb, threads, bw);
+            results[i * threadCounts + rangeIdx] = bw;
         }
+
+        if (!shared) FreeTestBuffers(&buffers);
     }
-    else 
-    {
-        elements = private_elements; // will fill arrays below, per-thread
+
+    if (shared) FreeTestBuffers(&buffers);
+
+    printf("Region (KB)");
+    for (uint64_t threads = range->start; threads <= range->end; threads += range->step) printf(",%lu", threads);
+    printf("\n");
+    for (int i = 0; i < test_size_count; i++) {
+        printf("%d", test_sizes[i]);
+        for (int j = 0; j < threadCounts; j++) printf(",%f", results[i * threadCounts + j]);
+        printf("\n");
     }
 
-    pthread_t* testThreads = (pthread_t*)malloc(threads * sizeof(pthread_t));
-    struct BandwidthTestThreadData* threadData = (struct BandwidthTestThreadData*)malloc(threads * sizeof(struct BandwidthTestThreadData));
+    free(results);
+}
+
+/// <summary>
+/// Measures random update throughput for each test size, with plain and atomic
+/// read-modify-writes. Prints one row per size
+/// </summary>
+void RunGupsTest(BandwidthThreadPool *pool, uint64_t threads, int shared) {
+    BandwidthTestBuffers buffers;
+    if (!AllocateTestBuffers(pool, &buffers, GetMaxTestSize(), threads, threads, shared, NUMA_NODE_ANY)) return;
+
+    printf("Region (KB),GUPS,Atomic GUPS\n");
+    for (int i = 0; i < test_size_count; i++) {
+        uint64_t sizeKb = test_sizes[i];
+        float plainGups = MeasureGups(pool, &buffers, sizeKb, threads, 0);
+        float atomicGups = MeasureGups(pool, &buffers, sizeKb, threads, 1);
+        printf("%lu,%f,%f\n", sizeKb, plainGups, atomicGups);
+        fflush(stdout);
+    }
+
+    FreeTestBuffers(&buffers);
+}
+
+// Random 8B xor updates, like HPCC RandomAccess. Indexes come from the LFSR, scaled to
+// the table with a multiply so the table doesn't need to be a power of two. Updates
+// don't depend on each other, so the core can keep as many in flight as it can track
+void *GupsThread(void *param) {
+    GupsThreadData *gupsData = (GupsThreadData *)param;
+    uint64_t *table = gupsData->table, tableLength = gupsData->tableLength;
+    uint64_t ran = gupsData->seed;
+    for (uint64_t i = 0; i < gupsData->updates; i++) {
+        ran = (ran << 1) ^ ((int64_t)ran < 0 ? GUPS_POLY : 0);
+        table[(uint64_t)(((unsigned __int128)ran * tableLength) >> 64)] ^= ran;
+    }
+
+    return NULL;
+}
+
+// same, but with lock xor/ldeor so updates from different threads can't be lost
+void *AtomicGupsThread(void *param) {
+    GupsThreadData *gupsData = (GupsThreadData *)param;
+    uint64_t *table = gupsData->table, tableLength = gupsData->tableLength;
+    uint64_t ran = gupsData->seed;
+    for (uint64_t i = 0; i < gupsData->updates; i++) {
+        ran = (ran << 1) ^ ((int64_t)ran < 0 ? GUPS_POLY : 0);
+        __atomic_fetch_xor(table + (uint64_t)(((unsigned __int128)ran * tableLength) >> 64), ran, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+/// <summary>
+/// Runs random updates over sizeKb of table. In shared mode all threads update one table,
+/// otherwise each thread gets sizeKb / threads to itself
+/// </summary>
+/// <returns>billions of updates per second</returns>
+float MeasureGups(BandwidthThreadPool *pool, BandwidthTestBuffers *buffers, uint64_t sizeKb, uint64_t threads, int atomic) {
+    uint64_t tableLength = sizeKb * 1024 / sizeof(uint64_t);
+    if (!buffers->shared) tableLength = (uint64_t)ceil((double)tableLength / (double)threads);
+    if (tableLength * sizeof(uint64_t) > buffers->elements[buffers->shared ? 0 : threads - 1] * sizeof(float)) {
+        fprintf(stderr, "%lu KB doesn't fit in the allocated test arrays\n", sizeKb);
+        return 0;
+    }
 
-    gettimeofday(&startTv, &startTz);
+    GupsThreadData *gupsData = (GupsThreadData *)malloc(threads * sizeof(GupsThreadData));
     for (uint64_t i = 0; i < threads; i++) {
-        if (shared) 
-        {
-            threadData[i].arr = testArr;
-            threadData[i].iterations = iterations;
-        }
-        else
-        {
-            threadData[i].arr = (float*)aligned_alloc(64, elements * sizeof(float));
-            if (threadData[i].arr == NULL)
-            {
-                fprintf(stderr, "Could not allocate memory for thread %ld\n", i);
-                return 0;
-            }
+        gupsData[i].table = (uint64_t *)(buffers->shared ? buffers->arrs[0] : buffers->arrs[i]);
+        gupsData[i].tableLength = tableLength;
+        gupsData[i].updates = GUPS_UPDATES_PER_THREAD;
+        gupsData[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1); // any nonzero start works for the LFSR
+    }
 
-            for (uint64_t arr_idx = 0; arr_idx < elements; arr_idx++) {
-                threadData[i].arr[arr_idx] = arr_idx + i + 0.5f;
-            }
+    uint64_t time_diff_ns = RunPoolJob(pool, threads, atomic ? AtomicGupsThread : GupsThread, gupsData, sizeof(GupsThreadData));
+    float gups = (double)GUPS_UPDATES_PER_THREAD * threads / (double)time_diff_ns;
+    fprintf(stderr, "%lu KB, %s: %f GUPS\n", sizeKb, atomic ? "atomic" : "plain", gups);
+    free(gupsData);
+    return gups;
+}
 
-            threadData[i].iterations = iterations * threads;
+/// <summary>
+/// Has one thread read from an increasing number of sequential streams at once, to find how many
+/// streams the hardware prefetchers can track. Prints one row per size and a column per stream count
+/// </summary>
+void RunStreamCountTest(BandwidthThreadPool *pool, SweepRange *range) {
+    BandwidthTestBuffers buffers;
+    if (!AllocateTestBuffers(pool, &buffers, GetMaxTestSize(), 1, 1, 1, NUMA_NODE_ANY)) return;
+
+    printf("Region (KB)");
+    for (uint64_t streams = range->start; streams <= range->end; streams += range->step) printf(",%lu", streams);
+    printf("\n");
+
+    for (int i = 0; i < test_size_count; i++) {
+        uint64_t sizeKb = test_sizes[i];
+        printf("%lu", sizeKb);
+        for (uint64_t streams = range->start; streams <= range->end; streams += range->step) {
+            float bw = MeasureStreamBw(pool, &buffers, sizeKb, streams);
+            fprintf(stderr, "%lu KB, %lu streams: %f GB/s\n", sizeKb, streams, bw);
+            printf(",%f", bw);
+            fflush(stdout);
         }
 
-        threadData[i].arr_length = elements;
-        threadData[i].bw = 0;
-        threadData[i].start = 0;
-        if (elements > 8192 * 1024) threadData[i].start = 4096 * i; // must be multiple of 128 because of unrolling
-        int pthreadRc = pthread_create(testThreads + i, NULL, ReadBandwidthTestThread, (void *)(threadData + i));
+        printf("\n");
     }
 
-    for (uint64_t i = 0; i < threads; i++) pthread_join(testThreads[i], NULL);
-    gettimeofday(&endTv, &endTz);
-
-    uint64_t time_diff_ms = 1000 * (endTv.tv_sec - startTv.tv_sec) + ((endTv.tv_usec - startTv.tv_usec) / 1000);
-    double gbTransferred = iterations * sizeof(float) * elements * threads / (double)1e9;
-    bw = 1000 * gbTransferred / (double)time_diff_ms;
-    if (!shared) bw = bw * threads; // iteration count is divided by thread count if in thread private mode
-    //printf("%f GB, %lu ms\n", gbTransferred, time_diff_ms);
+    FreeTestBuffers(&buffers);
+}
 
-    free(testThreads);
-    free(testArr); // should be null in not-shared (private) mode
+typedef uint64_t StreamVec __attribute__((vector_size(16)));
 
-    if (!shared) {
-        for (uint64_t i = 0; i < threads; i++) {
-            free(threadData[i].arr);
+// Reads a 64B line from each stream in turn, then moves every stream forward by a line
+void *StreamReadThread(void *param) {
+    StreamReadThreadData *streamData = (StreamReadThreadData *)param;
+    StreamVec acc0 = { 0 }, acc1 = { 0 }, acc2 = { 0 }, acc3 = { 0 };
+    for (uint64_t iter = 0; iter < streamData->iterations; iter++) {
+        for (uint64_t offset = 0; offset < streamData->streamBytes; offset += 64) {
+            char *line = streamData->arr + offset;
+            for (uint64_t stream = 0; stream < streamData->streamCount; stream++, line += streamData->streamBytes) {
+                acc0 += *(StreamVec *)line;
+                acc1 += *(StreamVec *)(line + 16);
+                acc2 += *(StreamVec *)(line + 32);
+                acc3 += *(StreamVec *)(line + 48);
+            }
         }
     }
 
-    free(threadData);
-    return bw;
+    acc0 += acc1 + acc2 + acc3;
+    if (acc0[0] == 0 && acc0[1] == 0) printf("woohoo\n");
+    return NULL;
+}
+
+/// <summary>
+/// Splits sizeKb into streamCount equal regions and reads them all at once from a single thread
+/// </summary>
+/// <returns>bandwidth in GB/s</returns>
+float MeasureStreamBw(BandwidthThreadPool *pool, BandwidthTestBuffers *buffers, uint64_t sizeKb, uint64_t streamCount) {
+    StreamReadThreadData streamData;
+    streamData.arr = (char *)buffers->arrs[0];
+    streamData.streamCount = streamCount;
+    streamData.streamBytes = (sizeKb * 1024 / streamCount) & ~63ULL;
+    if (streamData.streamBytes == 0) return 0;
+
+    // there are a lot more runs than the regular test, so transfer less per run
+    streamData.iterations = GetIterationCount(sizeKb, 1) / 16;
+    if (streamData.iterations < 8) streamData.iterations = 8;
+
+    uint64_t time_diff_ns = RunPoolJob(pool, 1, StreamReadThread, &streamData, sizeof(StreamReadThreadData));
+    return (double)streamData.iterations * streamData.streamBytes * streamCount / (double)time_diff_ns;
 }
 
+// Times single passes over the array. Timing is done here rather than around the pool
+// job, because a pass over a small array is far shorter than waking up the pool
+void *ColdReadThread(void *param) {
+    ColdReadThreadData *coldData = (ColdReadThreadData *)param;
+    uint64_t arrBytes = coldData->arr_length * sizeof(float);
+    struct timespec startTs, endTs;
+    float sum = 0;
+    coldData->readTimeNs = 0;
+    for (uint64_t rep = 0; rep < coldData->reps; rep++) {
+        if (coldData->flush && coldData->evictBuffer != NULL) {
+            uint64_t evictSum = 0;
+            for (uint64_t offset = 0; offset < COLD_EVICT_BYTES; offset += 64) evictSum += coldData->evictBuffer[offset]++;
+            if (evictSum == 1) printf("woohoo\n");
+        } else if (coldData->flush) {
 #ifdef __x86_64
-__attribute((ms_abi)) float scalar_read(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) {
+            clflushopt_lines(coldData->arr, arrBytes);
 #else
-float scalar_read(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) {
+            dc_civac_lines(coldData->arr, arrBytes);
 #endif
-    float sum = 0;
-    if (start + 16 >= arr_length) return 0;
+        }
 
-    uint64_t iter_idx = 0, i = start;
-    float s1 = 0, s2 = 1, s3 = 0, s4 = 1, s5 = 0, s6 = 1, s7 = 0, s8 = 1;
-    while (iter_idx < iterations) {
-        s1 += arr[i];
-        s2 *= arr[i + 1];
-        s3 += arr[i + 2];
-        s4 *= arr[i + 3];
-        s5 += arr[i + 4];
-        s6 *= arr[i + 5];
-        s7 += arr[i + 6];
-        s8 *= arr[i + 7];
-        i += 8;
-        if (i + 7 >= arr_length) i = 0;
-        if (i == start) iter_idx++;
+        clock_gettime(CLOCK_MONOTONIC, &startTs);
+        sum += bw_func(coldData->arr, coldData->arr_length, 1, 0);
+        clock_gettime(CLOCK_MONOTONIC, &endTs);
+        coldData->readTimeNs += 1000000000ULL * (endTs.tv_sec - startTs.tv_sec) + (endTs.tv_nsec - startTs.tv_nsec);
     }
-        
-    sum += s1 + s2 + s3 + s4 + s5 + s6 + s7 + s8;
 
-    return sum;
+    if (sum == 0) printf("woohoo\n");
+    return NULL;
 }
 
-void *ReadBandwidthTestThread(void *param) {
-    BandwidthTestThreadData* bwTestData = (BandwidthTestThreadData*)param;
-    float sum = bw_func(bwTestData->arr, bwTestData->arr_length, bwTestData->iterations, bwTestData->start);
+/// <summary>
+/// Measures the first pass over each thread's array right after flushing it from the caches,
+/// next to the same single-pass measurement with the array left in cache. Each thread reads
+/// its own sizeKb / threads, and bandwidth is summed across threads
+/// </summary>
+void RunColdCacheTest(BandwidthThreadPool *pool, uint64_t threads) {
+    BandwidthTestBuffers buffers;
+    char *evictBuffer = NULL;
+    ColdReadThreadData *coldData = (ColdReadThreadData *)malloc(threads * sizeof(ColdReadThreadData));
+#ifdef __x86_64
+    uint32_t cpuidEax, cpuidEbx, cpuidEcx, cpuidEdx;
+    __cpuid_count(7, 0, cpuidEax, cpuidEbx, cpuidEcx, cpuidEdx);
+    if (!(cpuidEbx & (1UL << 23))) {
+        // no clflushopt, so fall back to pushing the array out with a big buffer
+        fprintf(stderr, "clflushopt not supported, evicting with a %llu MB buffer\n", COLD_EVICT_BYTES / (1024 * 1024));
+        evictBuffer = (char *)malloc(COLD_EVICT_BYTES * threads);
+        if (evictBuffer == NULL) {
+            fprintf(stderr, "Could not allocate eviction buffer\n");
+            free(coldData);
+            return;
+        }
+
+        memset(evictBuffer, 1, COLD_EVICT_BYTES * threads);
+    }
+#endif
+
+    if (!AllocateTestBuffers(pool, &buffers, GetMaxTestSize(), threads, threads, 0, NUMA_NODE_ANY)) {
+        free(evictBuffer);
+        free(coldData);
+        return;
+    }
+
+    printf("Region (KB),Cold (GB/s),Hot (GB/s)\n");
+    for (int i = 0; i < test_size_count; i++) {
+        uint64_t sizeKb = test_sizes[i];
+        float bw[2];
+        if (sizeKb < threads) {
+            fprintf(stderr, "Too many threads for this test size\n");
+            continue;
+        }
+
+        // read 256 MB or so in total, with fewer passes when each one means walking the eviction buffer
+        uint64_t elements = (uint64_t)ceil(((double)sizeKb * 1024 / sizeof(float)) / (double)threads);
+        uint64_t reps = 256 * 1024 / sizeKb;
+        if (reps > 1024) reps = 1024;
+        if (evictBuffer != NULL && reps > 16) reps = 16;
+        if (reps < 4) reps = 4;
+
+        for (int flush = 1; flush >= 0; flush--) {
+            for (uint64_t t = 0; t < threads; t++) {
+                coldData[t].arr = buffers.arrs[t];
+                coldData[t].arr_length = elements;
+                coldData[t].reps = reps;
+                coldData[t].flush = flush;
+                coldData[t].evictBuffer = evictBuffer == NULL ? NULL : evictBuffer + t * COLD_EVICT_BYTES;
+            }
+
+            RunPoolJob(pool, threads, ColdReadThread, coldData, sizeof(ColdReadThreadData));
+            bw[flush] = 0;
+            for (uint64_t t = 0; t < threads; t++) bw[flush] += (double)reps * elements * sizeof(float) / (double)coldData[t].readTimeNs;
+        }
+
+        fprintf(stderr, "%lu KB: %f GB/s cold, %f GB/s hot\n", sizeKb, bw[1], bw[0]);
+        printf("%lu,%f,%f\n", sizeKb, bw[1], bw[0]);
+        fflush(stdout);
+    }
+
+    FreeTestBuffers(&buffers);
+    free(evictBuffer);
+    free(coldData);
+}
+
+// Brings the array into cache clean or dirty, then times the flush/writeback instruction over it
+void *FlushThread(void *param) {
+    FlushThreadData *flushData = (FlushThreadData *)param;
+    uint64_t arrBytes = flushData->arr_length * sizeof(float);
+    struct timespec startTs, endTs;
+    float sum = 0;
+    flushData->flushTimeNs = 0;
+    for (uint64_t rep = 0; rep < flushData->reps; rep++) {
+        if (flushData->dirty) {
+            for (uint64_t i = 0; i < flushData->arr_length; i += 64 / sizeof(float)) flushData->arr[i] += 1.0f;
+        } else {
+            sum += bw_func(flushData->arr, flushData->arr_length, 1, 0);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &startTs);
+        flushData->flushFunc(flushData->arr, arrBytes);
+        clock_gettime(CLOCK_MONOTONIC, &endTs);
+        flushData->flushTimeNs += 1000000000ULL * (endTs.tv_sec - startTs.tv_sec) + (endTs.tv_nsec - startTs.tv_nsec);
+    }
+
+    if (!flushData->dirty && sum == 0) printf("woohoo\n");
+    return NULL;
+}
+
+/// <summary>
+/// Measures how fast each supported cache maintenance instruction gets through each thread's
+/// array, when the lines are cached clean and when they're dirty and have to be written back.
+/// Throughput is bytes covered per second, summed across threads
+/// </summary>
+void RunFlushTest(BandwidthThreadPool *pool, uint64_t threads) {
+    BandwidthTestBuffers buffers;
+    int flushCount = sizeof(flush_funcs) / sizeof(FlushFunc);
+    int supported[sizeof(flush_funcs) / sizeof(FlushFunc)];
+    FlushThreadData *flushData = (FlushThreadData *)malloc(threads * sizeof(FlushThreadData));
+    for (int f = 0; f < flushCount; f++) supported[f] = 1;
+#ifdef __x86_64
+    uint32_t cpuidEax, cpuidEbx, cpuidEcx, cpuidEdx;
+    __cpuid(1, cpuidEax, cpuidEbx, cpuidEcx, cpuidEdx);
+    supported[0] = (cpuidEdx >> 19) & 1;
+    __cpuid_count(7, 0, cpuidEax, cpuidEbx, cpuidEcx, cpuidEdx);
+    supported[1] = (cpuidEbx >> 23) & 1;
+    supported[2] = (cpuidEbx >> 24) & 1;
+#endif
+
+    if (!AllocateTestBuffers(pool, &buffers, GetMaxTestSize(), threads, threads, 0, NUMA_NODE_ANY)) {
+        free(flushData);
+        return;
+    }
+
+    printf("Region (KB)");
+    for (int f = 0; f < flushCount; f++) {
+        if (supported[f]) printf(",%s clean (GB/s),%s dirty (GB/s)", flush_names[f], flush_names[f]);
+        else fprintf(stderr, "%s not supported\n", flush_names[f]);
+    }
+
+    printf("\n");
+    for (int i = 0; i < test_size_count; i++) {
+        uint64_t sizeKb = test_sizes[i];
+        if (sizeKb < threads) {
+            fprintf(stderr, "Too many threads for this test size\n");
+            continue;
+        }
+
+        uint64_t elements = (uint64_t)ceil(((double)sizeKb * 1024 / sizeof(float)) / (double)threads);
+        uint64_t reps = 256 * 1024 / sizeKb;
+        if (reps > 1024) reps = 1024;
+        if (reps < 4) reps = 4;
+
+        printf("%lu", sizeKb);
+        for (int f = 0; f < flushCount; f++) {
+            if (!supported[f]) continue;
+            for (int dirty = 0; dirty < 2; dirty++) {
+                float bw = 0;
+                for (uint64_t t = 0; t < threads; t++) {
+                    flushData[t].arr = buffers.arrs[t];
+                    flushData[t].arr_length = elements;
+                    flushData[t].reps = reps;
+                    flushData[t].flushFunc = flush_funcs[f];
+                    flushData[t].dirty = dirty;
+                }
+
+                RunPoolJob(pool, threads, FlushThread, flushData, sizeof(FlushThreadData));
+                for (uint64_t t = 0; t < threads; t++) bw += (double)reps * elements * sizeof(float) / (double)flushData[t].flushTimeNs;
+                fprintf(stderr, "%lu KB, %s %s: %f GB/s\n", sizeKb, flush_names[f], dirty ? "dirty" : "clean", bw);
+                printf(",%f", bw);
+            }
+        }
+
+        printf("\n");
+        fflush(stdout);
+    }
+
+    FreeTestBuffers(&buffers);
+    free(flushData);
+}
+
+/// <summary>
+/// Switches bw_func to the software prefetch version of the current read kernel
+/// </summary>
+/// <returns>1 on success, 0 if there's no prefetch version to use</returns>
+int SetPrefetchKernel(int hintIdx) {
+#ifdef __x86_64
+    if (bw_func == avx512_read) {
+        bw_func = prefetch512_funcs[hintIdx];
+        return 1;
+    }
+
+    if (!__builtin_cpu_supports("avx")) {
+        fprintf(stderr, "Prefetch kernels need AVX\n");
+        return 0;
+    }
+
+    if (bw_func != asm_read) fprintf(stderr, "Prefetch kernels use AVX, ignoring -method\n");
+#endif
+    bw_func = prefetch_funcs[hintIdx];
+    return 1;
+}
+
+/// <summary>
+/// Measures bandwidth for each test size without software prefetch, then with each
+/// prefetch type at each distance. Prints one row per size and a column for each
+/// prefetch type and distance
+/// </summary>
+void RunPrefetchSweep(BandwidthThreadPool *pool, uint64_t threads, int shared) {
+    BandwidthTestBuffers buffers;
+    int hintCount = sizeof(prefetch_names) / sizeof(prefetch_names[0]);
+    int distanceCount = sizeof(prefetch_sweep_distances) / sizeof(prefetch_sweep_distances[0]);
+    BwFunc baseFunc = bw_func;
+    if (!AllocateTestBuffers(pool, &buffers, GetMaxTestSize(), threads, threads, shared, NUMA_NODE_ANY)) return;
+
+    printf("Region (KB),No Prefetch");
+    for (int hintIdx = 0; hintIdx < hintCount; hintIdx++)
+        for (int distIdx = 0; distIdx < distanceCount; distIdx++)
+            printf(",%s %lu B", prefetch_names[hintIdx], prefetch_sweep_distances[distIdx]);
+    printf("\n");
+
+    for (int i = 0; i < test_size_count; i++) {
+        uint64_t sizeKb = test_sizes[i];
+        // 28 measurements per size, so each one gets a fraction of the usual run
+        uint64_t iterations = GetIterationCount(sizeKb, threads) / 16;
+        if (iterations < 8) iterations = 8;
+        bw_func = baseFunc;
+        printf("%lu,%f", sizeKb, MeasureBw(pool, &buffers, sizeKb, iterations, threads, 0));
+        for (int hintIdx = 0; hintIdx < hintCount; hintIdx++) {
+            bw_func = baseFunc;
+            if (!SetPrefetchKernel(hintIdx)) break;
+            for (int distIdx = 0; distIdx < distanceCount; distIdx++) {
+                prefetch_distance = prefetch_sweep_distances[distIdx];
+                float bw = MeasureBw(pool, &buffers, sizeKb, iterations, threads, 0);
+                fprintf(stderr, "%lu KB, %s prefetch %lu B ahead: %f GB/s\n", sizeKb, prefetch_names[hintIdx], prefetch_distance, bw);
+                printf(",%f", bw);
+                fflush(stdout);
+            }
+        }
+
+        printf("\n");
+    }
+
+    bw_func = baseFunc;
+    FreeTestBuffers(&buffers);
+}
+
+// Goes through lines [0, lines) in groups of reads + writes lines, reading the first
+// reads lines in each group and overwriting the rest without reading them
+static inline void MixedReadWriteRange(char *arr, uint64_t lines, int reads, int writes, StreamVec *acc, StreamVec value) {
+    char *line = arr, *end = arr + lines * 64;
+    while (line < end) {
+        for (int r = 0; r < reads && line < end; r++, line += 64) {
+            acc[0] += *(StreamVec *)line;
+            acc[1] += *(StreamVec *)(line + 16);
+            acc[2] += *(StreamVec *)(line + 32);
+            acc[3] += *(StreamVec *)(line + 48);
+        }
+
+        for (int w = 0; w < writes && line < end; w++, line += 64) {
+            *(StreamVec *)line = value;
+            *(StreamVec *)(line + 16) = value;
+            *(StreamVec *)(line + 32) = value;
+            *(StreamVec *)(line + 48) = value;
+        }
+    }
+}
+
+// Same pass semantics as the read kernels: from start to the end of the array, then wrap around
+// back to start, iterations times. Every byte is either read or written once per pass
+static inline float MixedReadWrite(float *arr, uint64_t arr_length, uint64_t iterations, uint64_t start, int reads, int writes) {
+    uint64_t lines = arr_length * sizeof(float) / 64, startLine = start * sizeof(float) / 64;
+    StreamVec acc[4] = { { 0 }, { 0 }, { 0 }, { 0 } };
+    for (uint64_t iter_idx = 0; iter_idx < iterations; iter_idx++) {
+        StreamVec value = { iter_idx + 1, iter_idx + 1 };
+        MixedReadWriteRange((char *)arr + startLine * 64, lines - startLine, reads, writes, acc, value);
+        MixedReadWriteRange((char *)arr, startLine, reads, writes, acc, value);
+    }
+
+    acc[0] += acc[1] + acc[2] + acc[3];
+    return (float)(acc[0][0] + acc[0][1] + iterations);
+}
+
+#ifdef __x86_64
+#define MIXED_RW_KERNEL(name, reads, writes) \
+    __attribute((ms_abi)) float name(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) { \
+        return MixedReadWrite(arr, arr_length, iterations, start, reads, writes); \
+    }
+#else
+#define MIXED_RW_KERNEL(name, reads, writes) \
+    float name(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) { \
+        return MixedReadWrite(arr, arr_length, iterations, start, reads, writes); \
+    }
+#endif
+
+MIXED_RW_KERNEL(mixed_rw_1_0, 1, 0)
+MIXED_RW_KERNEL(mixed_rw_3_1, 3, 1)
+MIXED_RW_KERNEL(mixed_rw_2_1, 2, 1)
+MIXED_RW_KERNEL(mixed_rw_1_1, 1, 1)
+MIXED_RW_KERNEL(mixed_rw_1_2, 1, 2)
+MIXED_RW_KERNEL(mixed_rw_0_1, 0, 1)
+
+const char *rw_ratio_names[] = { "1:0", "3:1", "2:1", "1:1", "1:2", "0:1" };
+BwFunc rw_ratio_funcs[] = { mixed_rw_1_0, mixed_rw_3_1, mixed_rw_2_1, mixed_rw_1_1, mixed_rw_1_2, mixed_rw_0_1 };
+
+/// <summary>
+/// Measures bandwidth with each read:write line ratio at each test size, using the same
+/// thread split as the read test. Bandwidth counts bytes read plus bytes written, without
+/// the reads for ownership that normal stores cause
+/// </summary>
+void RunRwRatioTest(BandwidthThreadPool *pool, uint64_t threads, int shared) {
+    BandwidthTestBuffers buffers;
+    int ratioCount = sizeof(rw_ratio_funcs) / sizeof(BwFunc);
+    BwFunc baseFunc = bw_func;
+    if (!AllocateTestBuffers(pool, &buffers, GetMaxTestSize(), threads, threads, shared, NUMA_NODE_ANY)) return;
+
+    printf("Region (KB)");
+    for (int ratioIdx = 0; ratioIdx < ratioCount; ratioIdx++) printf(",%s (GB/s)", rw_ratio_names[ratioIdx]);
+    printf("\n");
+
+    for (int i = 0; i < test_size_count; i++) {
+        uint64_t sizeKb = test_sizes[i];
+        uint64_t iterations = GetIterationCount(sizeKb, threads);
+        printf("%lu", sizeKb);
+        for (int ratioIdx = 0; ratioIdx < ratioCount; ratioIdx++) {
+            bw_func = rw_ratio_funcs[ratioIdx];
+            float bw = MeasureBw(pool, &buffers, sizeKb, iterations, threads, 0);
+            fprintf(stderr, "%lu KB, %s read:write: %f GB/s\n", sizeKb, rw_ratio_names[ratioIdx], bw);
+            printf(",%f", bw);
+            fflush(stdout);
+        }
+
+        printf("\n");
+    }
+
+    bw_func = baseFunc;
+    FreeTestBuffers(&buffers);
+}
+
+#ifdef __linux__
+/// <summary>
+/// Parses a sysfs list like "0-3,8-11" into an array of ints
+/// </summary>
+/// <param name="path">sysfs file to read</param>
+/// <param name="count">set to number of entries</param>
+/// <returns>malloc-ed array of entries, or NULL if the file couldn't be read</returns>
+int *ReadSysfsList(const char *path, int *count) {
+    char buf[4096];
+    char *str = buf, *end;
+    int *list = NULL, capacity = 0;
+    FILE *f = fopen(path, "r");
+    *count = 0;
+    if (f == NULL) return NULL;
+    if (fgets(buf, sizeof(buf), f) == NULL) buf[0] = '\0';
+    fclose(f);
+
+    while (*str != '\0' && *str != '\n') {
+        int first = strtol(str, &end, 10), last = first;
+        if (end == str) break;
+        if (*end == '-') last = strtol(end + 1, &end, 10);
+        for (int i = first; i <= last; i++) {
+            if (*count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                list = (int *)realloc(list, capacity * sizeof(int));
+            }
+
+            list[(*count)++] = i;
+        }
+
+        str = (*end == ',') ? end + 1 : end;
+    }
+
+    if (list == NULL) list = (int *)malloc(sizeof(int));
+    return list;
+}
+
+typedef struct ThreadAffinityData {
+    int cpu;
+} ThreadAffinityData;
+
+// pool job that pins the calling worker to one CPU
+void *SetAffinityThread(void *param) {
+    ThreadAffinityData *affinityData = (ThreadAffinityData *)param;
+    cpu_set_t *cpuset = CPU_ALLOC(affinityData->cpu + 1);
+    size_t cpusetSize = CPU_ALLOC_SIZE(affinityData->cpu + 1);
+    CPU_ZERO_S(cpusetSize, cpuset);
+    CPU_SET_S(affinityData->cpu, cpusetSize, cpuset);
+    if (sched_setaffinity(0, cpusetSize, cpuset) != 0) {
+        fprintf(stderr, "Could not pin thread to CPU %d\n", affinityData->cpu);
+    }
+
+    CPU_FREE(cpuset);
+    return NULL;
+}
+
+/// <summary>
+/// Runs reader threads on each node's CPUs against memory bound to each node,
+/// and against memory interleaved across all nodes. Prints one row per
+/// thread count and CPU node, with a column per memory node
+/// </summary>
+void RunNumaMatrix(BandwidthThreadPool *pool, SweepRange *range, uint64_t sizeKb, int shared) {
+    BandwidthTestBuffers buffers;
+    ThreadAffinityData *affinityData;
+    int nodeCount, threadCounts = 0;
+    int **nodeCpus, *nodeCpuCounts;
+    float *results;
+    char path[128];
+    int *nodes = ReadSysfsList("/sys/devices/system/node/online", &nodeCount);
+    if (nodes == NULL || nodeCount == 0) {
+        fprintf(stderr, "Could not read NUMA nodes from sysfs\n");
+        return;
+    }
+
+    fprintf(stderr, "%d NUMA nodes, %lu KB test size\n", nodeCount, sizeKb);
+    for (uint64_t threads = range->start; threads <= range->end; threads += range->step) threadCounts++;
+    affinityData = (ThreadAffinityData *)malloc(pool->threads * sizeof(ThreadAffinityData));
+    nodeCpus = (int **)malloc(nodeCount * sizeof(int *));
+    nodeCpuCounts = (int *)malloc(nodeCount * sizeof(int));
+    results = (float *)calloc(threadCounts * nodeCount * (nodeCount + 1), sizeof(float));
+    for (int cpuIdx = 0; cpuIdx < nodeCount; cpuIdx++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes[cpuIdx]);
+        nodeCpus[cpuIdx] = ReadSysfsList(path, nodeCpuCounts + cpuIdx);
+        if (nodeCpus[cpuIdx] == NULL || nodeCpuCounts[cpuIdx] == 0) {
+            fprintf(stderr, "Node %d has no CPUs, skipping\n", nodes[cpuIdx]);
+            nodeCpuCounts[cpuIdx] = 0;
+        }
+    }
+
+    // each memory placement is set up once and then read from every node. private arrays
+    // are set up per thread count, so memory stays at sizeKb
+    for (int memIdx = 0; memIdx <= nodeCount; memIdx++) {
+        int memNode = memIdx == nodeCount ? NUMA_NODE_INTERLEAVE : nodes[memIdx];
+        if (shared && !AllocateTestBuffers(pool, &buffers, sizeKb, range->start, range->end, shared, memNode)) continue;
+        int threadIdx = 0;
+        for (uint64_t threads = range->start; threads <= range->end; threads += range->step, threadIdx++) {
+            if (!shared && !AllocateTestBuffers(pool, &buffers, sizeKb, threads, threads, shared, memNode)) continue;
+            for (int cpuIdx = 0; cpuIdx < nodeCount; cpuIdx++) {
+                int cpuCount = nodeCpuCounts[cpuIdx];
+                if (cpuCount == 0) continue;
+                for (uint64_t i = 0; i < pool->threads; i++) affinityData[i].cpu = nodeCpus[cpuIdx][i % cpuCount];
+                RunPoolJob(pool, pool->threads, SetAffinityThread, affinityData, sizeof(ThreadAffinityData));
+
+                if (threads > cpuCount) fprintf(stderr, "%lu threads is more than the %d CPUs on node %d\n", threads, cpuCount, nodes[cpuIdx]);
+                float bw = MeasureBw(pool, &buffers, sizeKb, GetIterationCount(sizeKb, threads), threads, 0);
+                if (memNode == NUMA_NODE_INTERLEAVE) fprintf(stderr, "%lu threads, CPU node %d, interleaved memory: %f GB/s\n", threads, nodes[cpuIdx], bw);
+                else fprintf(stderr, "%lu threads, CPU node %d, memory node %d: %f GB/s\n", threads, nodes[cpuIdx], memNode, bw);
+                results[(threadIdx * nodeCount + cpuIdx) * (nodeCount + 1) + memIdx] = bw;
+            }
+
+            if (!shared) FreeTestBuffers(&buffers);
+        }
+
+        if (shared) FreeTestBuffers(&buffers);
+    }
+
+    printf("Threads,CPU Node");
+    for (int memIdx = 0; memIdx < nodeCount; memIdx++) printf(",Mem Node %d", nodes[memIdx]);
+    printf(",Interleaved\n");
+    int threadIdx = 0;
+    for (uint64_t threads = range->start; threads <= range->end; threads += range->step, threadIdx++) {
+        for (int cpuIdx = 0; cpuIdx < nodeCount; cpuIdx++) {
+            if (nodeCpuCounts[cpuIdx] == 0) continue;
+            printf("%lu,%d", threads, nodes[cpuIdx]);
+            for (int memIdx = 0; memIdx <= nodeCount; memIdx++) printf(",%f", results[(threadIdx * nodeCount + cpuIdx) * (nodeCount + 1) + memIdx]);
+            printf("\n");
+        }
+    }
+
+    for (int cpuIdx = 0; cpuIdx < nodeCount; cpuIdx++) free(nodeCpus[cpuIdx]);
+    free(nodeCpus);
+    free(nodeCpuCounts);
+    free(results);
+    free(affinityData);
+    free(nodes);
+}
+
+// sizes for the core to core test if -sizes isn't given. up to about L3 size
+int default_c2c_sizes[] = { 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768 };
+
+// data moved between each pair of cores, per buffer size
+#define C2C_BYTES_PER_TEST (64ULL * 1024 * 1024)
+
+typedef struct CoreToCoreThreadData {
+    char *buffer;
+    uint64_t bytes;
+    uint64_t rounds;
+    volatile uint64_t *flag; // odd = buffer filled, even = buffer consumed
+    int writer;
+} CoreToCoreThreadData;
+
+// Writer fills the buffer and flips the flag, then the reader reads all of it and flips it back
+void *CoreToCoreThread(void *param) {
+    CoreToCoreThreadData *c2cData = (CoreToCoreThreadData *)param;
+    StreamVec acc = { 0 };
+    for (uint64_t round = 0; round < c2cData->rounds; round++) {
+        StreamVec value = { round, round };
+        if (c2cData->writer) {
+            while (__atomic_load_n(c2cData->flag, __ATOMIC_ACQUIRE) != 2 * round);
+            for (uint64_t offset = 0; offset < c2cData->bytes; offset += 64) {
+                *(StreamVec *)(c2cData->buffer + offset) = value;
+                *(StreamVec *)(c2cData->buffer + offset + 16) = value;
+                *(StreamVec *)(c2cData->buffer + offset + 32) = value;
+                *(StreamVec *)(c2cData->buffer + offset + 48) = value;
+            }
+
+            __atomic_store_n(c2cData->flag, 2 * round + 1, __ATOMIC_RELEASE);
+        } else {
+            while (__atomic_load_n(c2cData->flag, __ATOMIC_ACQUIRE) != 2 * round + 1);
+            for (uint64_t offset = 0; offset < c2cData->bytes; offset += 64) {
+                acc += *(StreamVec *)(c2cData->buffer + offset);
+                acc += *(StreamVec *)(c2cData->buffer + offset + 16);
+                acc += *(StreamVec *)(c2cData->buffer + offset + 32);
+                acc += *(StreamVec *)(c2cData->buffer + offset + 48);
+            }
+
+            __atomic_store_n(c2cData->flag, 2 * round + 2, __ATOMIC_RELEASE);
+        }
+    }
+
+    if (!c2cData->writer && acc[0] == 0 && c2cData->rounds > 2) printf("woohoo\n");
+    return NULL;
+}
+
+/// <summary>
+/// Measures handing a buffer back and forth between a writer and a reader pinned to
+/// different CPUs, for every pair of CPUs (or every cpuStride-th CPU) and each buffer size.
+/// Prints a writer x reader matrix in GB/s for each size
+/// </summary>
+void RunCoreToCoreTest(BandwidthThreadPool *pool, int cpuStride) {
+    int cpuCount, sizeCount = test_size_count, *sizes = test_sizes;
+    ThreadAffinityData affinityData[2];
+    CoreToCoreThreadData c2cData[2];
+    int *allCpus = ReadSysfsList("/sys/devices/system/cpu/online", &cpuCount);
+    if (allCpus == NULL || cpuCount < 2) {
+        fprintf(stderr, "Need at least two CPUs\n");
+        free(allCpus);
+        return;
+    }
+
+    if (test_sizes == default_test_sizes) {
+        sizes = default_c2c_sizes;
+        sizeCount = sizeof(default_c2c_sizes) / sizeof(int);
+    }
+
+    int *cpus = (int *)malloc(cpuCount * sizeof(int)), testCpuCount = 0;
+    for (int i = 0; i < cpuCount; i += cpuStride) cpus[testCpuCount++] = allCpus[i];
+    float *results = (float *)malloc(testCpuCount * testCpuCount * sizeof(float));
+    uint64_t maxSizeKb = 0;
+    for (int i = 0; i < sizeCount; i++) if (sizes[i] > maxSizeKb) maxSizeKb = sizes[i];
+    char *buffer = (char *)aligned_alloc(4096, maxSizeKb * 1024);
+    volatile uint64_t *flag = (volatile uint64_t *)aligned_alloc(64, 64);
+    if (buffer == NULL || flag == NULL) {
+        fprintf(stderr, "Could not allocate memory\n");
+        free((void *)flag);
+        free(buffer);
+        free(results);
+        free(cpus);
+        free(allCpus);
+        return;
+    }
+
+    memset(buffer, 1, maxSizeKb * 1024);
+    for (int sizeIdx = 0; sizeIdx < sizeCount; sizeIdx++) {
+        uint64_t bytes = (uint64_t)sizes[sizeIdx] * 1024;
+        uint64_t rounds = C2C_BYTES_PER_TEST / bytes;
+        if (rounds < 16) rounds = 16;
+        for (int writerIdx = 0; writerIdx < testCpuCount; writerIdx++) {
+            for (int readerIdx = 0; readerIdx < testCpuCount; readerIdx++) {
+                if (writerIdx == readerIdx) continue;
+                affinityData[0].cpu = cpus[writerIdx];
+                affinityData[1].cpu = cpus[readerIdx];
+                RunPoolJob(pool, 2, SetAffinityThread, affinityData, sizeof(ThreadAffinityData));
+
+                *flag = 0;
+                for (int i = 0; i < 2; i++) {
+                    c2cData[i].buffer = buffer;
+                    c2cData[i].bytes = bytes;
+                    c2cData[i].rounds = rounds;
+                    c2cData[i].flag = flag;
+                    c2cData[i].writer = i == 0;
+                }
+
+                uint64_t time_diff_ns = RunPoolJob(pool, 2, CoreToCoreThread, c2cData, sizeof(CoreToCoreThreadData));
+                float bw = (double)rounds * bytes / (double)time_diff_ns;
+                fprintf(stderr, "%d KB, CPU %d to %d: %f GB/s\n", sizes[sizeIdx], cpus[writerIdx], cpus[readerIdx], bw);
+                results[writerIdx * testCpuCount + readerIdx] = bw;
+            }
+        }
+
+        printf("Buffer size (KB),%d\nWriter\\Reader", sizes[sizeIdx]);
+        for (int readerIdx = 0; readerIdx < testCpuCount; readerIdx++) printf(",%d", cpus[readerIdx]);
+        printf("\n");
+        for (int writerIdx = 0; writerIdx < testCpuCount; writerIdx++) {
+            printf("%d", cpus[writerIdx]);
+            for (int readerIdx = 0; readerIdx < testCpuCount; readerIdx++) {
+                if (writerIdx == readerIdx) printf(",x");
+                else printf(",%f", results[writerIdx * testCpuCount + readerIdx]);
+            }
+
+            printf("\n");
+        }
+
+        fflush(stdout);
+    }
+
+    free((void *)flag);
+    free(buffer);
+    free(results);
+    free(cpus);
+    free(allCpus);
+}
+
+// block sizes for the file read paths, in KB
+uint64_t io_block_sizes[] = { 4, 16, 64, 256, 1024, 4096 };
+const char *io_path_names[] = { "mmap", "read", "O_DIRECT", "io_uring" };
+
+/// <summary>
+/// Opens the test file, creating it with fileSizeMb of data if it doesn't exist
+/// </summary>
+/// <returns>file size in bytes, rounded down to 1 MB, or 0 on failure</returns>
+uint64_t PrepareTestFile(const char *path, uint64_t fileSizeMb) {
+    struct stat st;
+    if (stat(path, &st) == 0) return st.st_size & ~((1ULL << 20) - 1);
+
+    fprintf(stderr, "Creating %lu MB test file %s\n", fileSizeMb, path);
+    int fd = open(path, O_CREAT | O_WRONLY, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Could not create %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    char *block = (char *)malloc(1 << 20);
+    for (uint64_t i = 0; i < (1 << 20); i++) block[i] = (char)(i * 7);
+    for (uint64_t mb = 0; mb < fileSizeMb; mb++) {
+        if (write(fd, block, 1 << 20) != (1 << 20)) {
+            fprintf(stderr, "Could not write %s: %s\n", path, strerror(errno));
+            fileSizeMb = 0;
+            break;
+        }
+    }
+
+    // dirty pages can't be dropped from the page cache, so get them on disk now
+    fsync(fd);
+    close(fd);
+    free(block);
+    return fileSizeMb << 20;
+}
+
+/// <summary>
+/// Drops the file from the page cache (cold), or reads it through once so it's all cached (warm)
+/// </summary>
+void SetFileCacheState(const char *path, uint64_t fileBytes, int warm) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    if (warm) {
+        char *buf = (char *)malloc(1 << 20);
+        while (read(fd, buf, 1 << 20) > 0);
+        free(buf);
+    } else {
+        posix_fadvise(fd, 0, fileBytes, POSIX_FADV_DONTNEED);
+    }
+
+    close(fd);
+}
+
+/// <summary>
+/// Maps the file and reads it with bw_func. Page faults count against the time
+/// </summary>
+/// <returns>ns taken</returns>
+uint64_t TimeMmapRead(const char *path, uint64_t fileBytes) {
+    struct timespec startTs, endTs;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    clock_gettime(CLOCK_MONOTONIC, &startTs);
+    float *map = (float *)mmap(NULL, fileBytes, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+
+    float sum = bw_func(map, fileBytes / sizeof(float), 1, 0);
+    clock_gettime(CLOCK_MONOTONIC, &endTs);
+    if (sum == 0) printf("woohoo\n");
+    munmap(map, fileBytes);
+    close(fd);
+    return 1000000000ULL * (endTs.tv_sec - startTs.tv_sec) + (endTs.tv_nsec - startTs.tv_nsec);
+}
+
+/// <summary>
+/// Reads the file with read() calls of blockBytes each, into the same buffer every time
+/// </summary>
+/// <param name="direct">open with O_DIRECT, bypassing the page cache</param>
+/// <returns>ns taken, or 0 if the file couldn't be read that way</returns>
+uint64_t TimeSyscallRead(const char *path, uint64_t fileBytes, uint64_t blockBytes, int direct) {
+    struct timespec startTs, endTs;
+    int fd = open(path, O_RDONLY | (direct ? O_DIRECT : 0));
+    if (fd < 0) return 0;
+
+    // O_DIRECT needs the buffer aligned to the logical block size. page alignment covers that
+    char *buf = (char *)aligned_alloc(4096, blockBytes);
+    uint64_t total = 0;
+    ssize_t bytesRead;
+    clock_gettime(CLOCK_MONOTONIC, &startTs);
+    while (total < fileBytes && (bytesRead = read(fd, buf, blockBytes)) > 0) total += bytesRead;
+    clock_gettime(CLOCK_MONOTONIC, &endTs);
+    free(buf);
+    close(fd);
+    if (total < fileBytes) return 0;
+    return 1000000000ULL * (endTs.tv_sec - startTs.tv_sec) + (endTs.tv_nsec - startTs.tv_nsec);
+}
+
+typedef struct IoUringQueue {
+    int fd;
+    uint32_t entries;
+    void *sqRing, *cqRing;
+    size_t sqRingBytes, cqRingBytes;
+    struct io_uring_sqe *sqes;
+    uint32_t *sqHead, *sqTail, *sqMask, *sqArray;
+    uint32_t *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+} IoUringQueue;
+
+/// <summary>
+/// Sets up an io_uring with raw syscalls, so there's no liburing dependency
+/// </summary>
+/// <returns>1 on success, 0 if the kernel doesn't support io_uring or it's disabled</returns>
+int CreateIoUring(IoUringQueue *ring, uint32_t entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(IoUringQueue));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return 0;
+
+    ring->entries = params.sq_entries;
+    ring->sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqRing = mmap(NULL, ring->sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cqRing = mmap(NULL, ring->cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        close(ring->fd);
+        return 0;
+    }
+
+    ring->sqHead = (uint32_t *)((char *)ring->sqRing + params.sq_off.head);
+    ring->sqTail = (uint32_t *)((char *)ring->sqRing + params.sq_off.tail);
+    ring->sqMask = (uint32_t *)((char *)ring->sqRing + params.sq_off.ring_mask);
+    ring->sqArray = (uint32_t *)((char *)ring->sqRing + params.sq_off.array);
+    ring->cqHead = (uint32_t *)((char *)ring->cqRing + params.cq_off.head);
+    ring->cqTail = (uint32_t *)((char *)ring->cqRing + params.cq_off.tail);
+    ring->cqMask = (uint32_t *)((char *)ring->cqRing + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cqRing + params.cq_off.cqes);
+    return 1;
+}
+
+void DestroyIoUring(IoUringQueue *ring) {
+    munmap(ring->sqes, ring->entries * sizeof(struct io_uring_sqe));
+    munmap(ring->cqRing, ring->cqRingBytes);
+    munmap(ring->sqRing, ring->sqRingBytes);
+    close(ring->fd);
+}
+
+/// <summary>
+/// Reads the file through io_uring, keeping queueDepth fixed-buffer reads of blockBytes in flight.
+/// Each slot has its own registered buffer, reused for every read issued from that slot. A short
+/// read keeps its slot and gets the rest of its block requeued
+/// </summary>
+/// <returns>ns taken, or 0 if io_uring isn't usable</returns>
+uint64_t TimeIoUringRead(const char *path, uint64_t fileBytes, uint64_t blockBytes, uint32_t queueDepth) {
+    IoUringQueue ring;
+    struct timespec startTs, endTs;
+    uint64_t elapsedNs = 0;
+    if (!CreateIoUring(&ring, queueDepth)) return 0;
+    if (queueDepth > ring.entries) queueDepth = ring.entries;
+
+    int fd = open(path, O_RDONLY);
+    char *buffers = (char *)aligned_alloc(4096, blockBytes * queueDepth);
+    struct iovec *iovecs = (struct iovec *)malloc(queueDepth * sizeof(struct iovec));
+    for (uint32_t slot = 0; slot < queueDepth; slot++) {
+        iovecs[slot].iov_base = buffers + slot * blockBytes;
+        iovecs[slot].iov_len = blockBytes;
+    }
+
+    if (fd < 0 || syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, iovecs, queueDepth) < 0) {
+        fprintf(stderr, "Could not register io_uring buffers: %s\n", strerror(errno));
+        goto cleanup;
+    }
+
+    uint64_t nextOffset = 0, completedBytes = 0;
+    uint32_t inFlight = 0, toSubmit = 0, freeSlotCount = queueDepth, retryCount = 0;
+    uint32_t *freeSlots = (uint32_t *)malloc(queueDepth * sizeof(uint32_t));
+    uint32_t *retrySlots = (uint32_t *)malloc(queueDepth * sizeof(uint32_t));
+    uint64_t *slotOffsets = (uint64_t *)malloc(queueDepth * sizeof(uint64_t));  // file offset of the slot's block
+    uint64_t *slotLens = (uint64_t *)malloc(queueDepth * sizeof(uint64_t));     // block length
+    uint64_t *slotDone = (uint64_t *)malloc(queueDepth * sizeof(uint64_t));     // bytes of the block read so far
+    for (uint32_t slot = 0; slot < queueDepth; slot++) freeSlots[slot] = slot;
+
+    clock_gettime(CLOCK_MONOTONIC, &startTs);
+    while (completedBytes < fileBytes) {
+        // requeue the rest of short reads first, then fill every free slot with the next block
+        uint32_t tail = *ring.sqTail;
+        while (retryCount > 0 || (freeSlotCount > 0 && nextOffset < fileBytes)) {
+            uint32_t slot;
+            if (retryCount > 0) {
+                slot = retrySlots[--retryCount];
+            } else {
+                slot = freeSlots[--freeSlotCount];
+                slotOffsets[slot] = nextOffset;
+                slotLens[slot] = fileBytes - nextOffset < blockBytes ? fileBytes - nextOffset : blockBytes;
+                slotDone[slot] = 0;
+                nextOffset += slotLens[slot];
+            }
+
+            uint32_t idx = tail & *ring.sqMask;
+            struct io_uring_sqe *sqe = ring.sqes + idx;
+            memset(sqe, 0, sizeof(struct io_uring_sqe));
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->fd = fd;
+            sqe->off = slotOffsets[slot] + slotDone[slot];
+            sqe->addr = (uint64_t)iovecs[slot].iov_base + slotDone[slot];
+            sqe->len = slotLens[slot] - slotDone[slot];
+            sqe->buf_index = slot;
+            sqe->user_data = slot;
+            ring.sqArray[idx] = idx;
+            tail++;
+            toSubmit++;
+        }
+
+        // nothing queued or outstanding means waiting for a completion would hang
+        if (toSubmit == 0 && inFlight == 0) break;
+        __atomic_store_n(ring.sqTail, tail, __ATOMIC_RELEASE);
+        int submitted = syscall(__NR_io_uring_enter, ring.fd, toSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (submitted < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "io_uring_enter failed: %s\n", strerror(errno));
+            break;
+        }
+
+        toSubmit -= submitted;
+        inFlight += submitted;
+
+        uint32_t head = *ring.cqHead;
+        int failed = 0;
+        while (head != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = ring.cqes + (head & *ring.cqMask);
+            uint32_t slot = (uint32_t)cqe->user_data;
+            if (cqe->res <= 0) {
+                failed = 1;
+                freeSlots[freeSlotCount++] = slot;
+            } else {
+                completedBytes += cqe->res;
+                slotDone[slot] += cqe->res;
+                if (slotDone[slot] < slotLens[slot]) retrySlots[retryCount++] = slot;
+                else freeSlots[freeSlotCount++] = slot;
+            }
+
+            inFlight--;
+            head++;
+        }
+
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+        if (failed) {
+            fprintf(stderr, "io_uring read failed\n");
+            break;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &endTs);
+    if (completedBytes >= fileBytes) elapsedNs = 1000000000ULL * (endTs.tv_sec - startTs.tv_sec) + (endTs.tv_nsec - startTs.tv_nsec);
+    free(slotDone);
+    free(slotLens);
+    free(slotOffsets);
+    free(retrySlots);
+    free(freeSlots);
+
+cleanup:
+    DestroyIoUring(&ring);
+    if (fd >= 0) close(fd);
+    free(iovecs);
+    free(buffers);
+    return elapsedNs;
+}
+
+/// <summary>
+/// Reads a file through mmap + bw_func, buffered read(), O_DIRECT read() and io_uring, at each
+/// block size with the page cache dropped (cold) and with the file already cached (warm)
+/// </summary>
+void RunFileIoTest(const char *path, uint64_t fileSizeMb, uint32_t queueDepth) {
+    uint64_t fileBytes = PrepareTestFile(path, fileSizeMb);
+    int pathCount = sizeof(io_path_names) / sizeof(io_path_names[0]);
+    int blockSizeCount = sizeof(io_block_sizes) / sizeof(io_block_sizes[0]);
+    if (fileBytes == 0) {
+        fprintf(stderr, "Test file needs to be at least 1 MB\n");
+        return;
+    }
+
+    fprintf(stderr, "Reading %lu MB from %s, io_uring queue depth %u\n", fileBytes >> 20, path, queueDepth);
+    printf("Path,Block (KB),Cold (GB/s),Warm (GB/s)\n");
+    for (int pathIdx = 0; pathIdx < pathCount; pathIdx++) {
+        // mmap reads the whole file with bw_func, so block size doesn't apply
+        for (int blockIdx = 0; blockIdx < (pathIdx == 0 ? 1 : blockSizeCount); blockIdx++) {
+            uint64_t blockBytes = io_block_sizes[blockIdx] * 1024;
+            float bw[2];
+            for (int warm = 0; warm < 2; warm++) {
+                uint64_t elapsedNs;
+                SetFileCacheState(path, fileBytes, warm);
+                if (pathIdx == 0) elapsedNs = TimeMmapRead(path, fileBytes);
+                else if (pathIdx == 3) elapsedNs = TimeIoUringRead(path, fileBytes, blockBytes, queueDepth);
+                else elapsedNs = TimeSyscallRead(path, fileBytes, blockBytes, pathIdx == 2);
+                bw[warm] = elapsedNs == 0 ? 0 : (double)fileBytes / (double)elapsedNs;
+            }
+
+            if (bw[0] == 0 && bw[1] == 0) {
+                fprintf(stderr, "%s not supported for this file\n", io_path_names[pathIdx]);
+                break;
+            }
+
+            fprintf(stderr, "%s, %lu KB blocks: %f GB/s cold, %f GB/s warm\n", io_path_names[pathIdx], pathIdx == 0 ? 0 : io_block_sizes[blockIdx], bw[0], bw[1]);
+            printf("%s,%lu,%f,%f\n", io_path_names[pathIdx], pathIdx == 0 ? 0 : io_block_sizes[blockIdx], bw[0], bw[1]);
+            fflush(stdout);
+        }
+    }
+}
+
+// interleaved copy splits deal out blocks of this size round robin
+#define COPY_INTERLEAVE_BYTES (64 * 1024)
+#define COPY_PASSES 3
+
+const char *copy_split_names[] = { "chunked", "interleaved", "numa" };
+
+typedef struct CopyThreadData {
+    char *dst;
+    char *src;
+    uint64_t start;       // offset of the first block
+    uint64_t end;         // stop before this offset
+    uint64_t blockBytes;
+    uint64_t strideBytes; // from one block to the next
+    CopyFunc copyFunc;
+} CopyThreadData;
+
+// Copies blocks from start to end, COPY_PASSES times over
+void *CopyThread(void *param) {
+    CopyThreadData *copyData = (CopyThreadData *)param;
+    for (int pass = 0; pass < COPY_PASSES; pass++) {
+        for (uint64_t offset = copyData->start; offset < copyData->end; offset += copyData->strideBytes) {
+            uint64_t len = copyData->blockBytes;
+            if (len > copyData->end - offset) len = copyData->end - offset;
+            copyData->copyFunc(copyData->dst + offset, copyData->src + offset, len);
+        }
+    }
+
+    return NULL;
+}
+
+/// <summary>
+/// Sets up each thread's share of a copy. Chunked gives each thread one contiguous range,
+/// interleaved deals out COPY_INTERLEAVE_BYTES blocks round robin, and numa gives each node's
+/// slice of the buffer to the threads pinned to that node, chunked between them
+/// </summary>
+void SetupCopySplit(CopyThreadData *copyData, uint64_t threads, int split, uint64_t bytes, uint64_t *sliceOffsets, int nodeCount) {
+    for (uint64_t t = 0; t < threads; t++) {
+        uint64_t rangeStart = 0, rangeEnd = bytes, rangeThreads = threads, rangeIdx = t;
+        if (split == 2) {
+            // thread t runs on node t % nodeCount
+            rangeStart = sliceOffsets[t % nodeCount];
+            rangeEnd = sliceOffsets[t % nodeCount + 1];
+            rangeThreads = threads / nodeCount + (t % nodeCount < threads % nodeCount ? 1 : 0);
+            rangeIdx = t / nodeCount;
+        }
+
+        if (split == 1) {
+            copyData[t].start = t * COPY_INTERLEAVE_BYTES;
+            copyData[t].end = bytes;
+            copyData[t].blockBytes = COPY_INTERLEAVE_BYTES;
+            copyData[t].strideBytes = threads * COPY_INTERLEAVE_BYTES;
+        } else {
+            // 4 KB aligned chunks keep every kernel call a multiple of 128 bytes
+            uint64_t chunkBytes = ((rangeEnd - rangeStart) / rangeThreads) & ~4095ULL;
+            copyData[t].start = rangeStart + rangeIdx * chunkBytes;
+            copyData[t].end = rangeIdx == rangeThreads - 1 ? rangeEnd : copyData[t].start + chunkBytes;
+            copyData[t].blockBytes = copyData[t].end - copyData[t].start;
+            copyData[t].strideBytes = copyData[t].blockBytes;
+            if (copyData[t].blockBytes == 0) copyData[t].strideBytes = 1;
+        }
+    }
+}
+
+/// <summary>
+/// Copies one big buffer into another with each thread count in range, splitting the range
+/// chunked, interleaved and NUMA-local, with regular and non-temporal stores. Reports copy
+/// throughput, which counts each byte once even though it's read and written
+/// </summary>
+void RunCopyTest(BandwidthThreadPool *pool, SweepRange *range, uint64_t sizeMb) {
+    uint64_t bytes = sizeMb * 1024 * 1024, srcMapped, dstMapped;
+    int nodeCount, threadCounts = 0, splitCount = sizeof(copy_split_names) / sizeof(copy_split_names[0]);
+    CopyFunc copyFuncs[] = { copy_regular, copy_nt };
+    const char *storeNames[] = { "regular", "NT" };
+    char path[128];
+    CopyThreadData *copyData = NULL;
+    ThreadAffinityData *affinityData = NULL;
+    float *results = NULL;
+    int *nodes = ReadSysfsList("/sys/devices/system/node/online", &nodeCount);
+    if (nodes == NULL || nodeCount == 0) {
+        // no NUMA info, so treat it as one node with all the CPUs
+        nodeCount = 1;
+        nodes = (int *)calloc(1, sizeof(int));
+    }
+
+    int **nodeCpus = (int **)malloc(nodeCount * sizeof(int *));
+    int *nodeCpuCounts = (int *)malloc(nodeCount * sizeof(int));
+    uint64_t *sliceOffsets = (uint64_t *)malloc((nodeCount + 1) * sizeof(uint64_t));
+    for (int nodeIdx = 0; nodeIdx < nodeCount; nodeIdx++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodes[nodeIdx]);
+        nodeCpus[nodeIdx] = ReadSysfsList(path, nodeCpuCounts + nodeIdx);
+        if (nodeCpus[nodeIdx] == NULL) nodeCpus[nodeIdx] = ReadSysfsList("/sys/devices/system/cpu/online", nodeCpuCounts + nodeIdx);
+        if (nodeCpus[nodeIdx] == NULL) nodeCpuCounts[nodeIdx] = 0;
+        sliceOffsets[nodeIdx] = (bytes / nodeCount * nodeIdx) & ~(2ULL * 1024 * 1024 - 1);
+    }
+
+    sliceOffsets[nodeCount] = bytes;
+    fprintf(stderr, "Copying %lu MB, %d NUMA nodes\n", sizeMb, nodeCount);
+    char *src = (char *)AllocateTestArray(bytes, NUMA_NODE_ANY, &srcMapped);
+    char *dst = (char *)AllocateTestArray(bytes, NUMA_NODE_ANY, &dstMapped);
+    if (src == NULL || dst == NULL) {
+        fprintf(stderr, "Could not allocate copy buffers\n");
+        goto cleanup;
+    }
+
+    // bind each node's slice of both buffers to that node before first touch. slices start on
+    // 2 MB boundaries, so only the bit before the first page boundary is left unbound
+    for (int nodeIdx = 0; nodeCount > 1 && nodeIdx < nodeCount; nodeIdx++) {
+        unsigned long nodeMask[16] = { 0 };
+        nodeMask[nodes[nodeIdx] / (sizeof(unsigned long) * 8)] |= 1UL << (nodes[nodeIdx] % (sizeof(unsigned long) * 8));
+        for (int bufIdx = 0; bufIdx < 2; bufIdx++) {
+            char *buf = bufIdx == 0 ? src : dst;
+            uintptr_t sliceStart = ((uintptr_t)buf + sliceOffsets[nodeIdx] + 4095) & ~4095ULL;
+            uintptr_t sliceEnd = ((uintptr_t)buf + sliceOffsets[nodeIdx + 1]) & ~4095ULL;
+            if (sliceEnd > sliceStart && syscall(SYS_mbind, (void *)sliceStart, sliceEnd - sliceStart, MPOL_BIND, nodeMask, sizeof(nodeMask) * 8, 0) != 0)
+                fprintf(stderr, "mbind to node %d failed\n", nodes[nodeIdx]);
+        }
+    }
+
+    memset(src, 1, bytes);
+    memset(dst, 0, bytes);
+
+    for (uint64_t threads = range->start; threads <= range->end; threads += range->step) threadCounts++;
+    copyData = (CopyThreadData *)malloc(pool->threads * sizeof(CopyThreadData));
+    affinityData = (ThreadAffinityData *)malloc(pool->threads * sizeof(ThreadAffinityData));
+    results = (float *)calloc(threadCounts * splitCount * 2, sizeof(float));
+
+    // numa goes last because it pins the pool threads, and the other splits should run unpinned
+    int cpulessNode = 0;
+    for (int nodeIdx = 0; nodeIdx < nodeCount; nodeIdx++) if (nodeCpuCounts[nodeIdx] == 0) cpulessNode = 1;
+    for (int split = 0; split < splitCount; split++) {
+        if (split == 2 && cpulessNode) {
+            fprintf(stderr, "Some NUMA nodes have no CPUs, skipping numa split\n");
+            break;
+        }
+
+        if (split == 2) {
+            for (uint64_t t = 0; t < pool->threads; t++) {
+                int nodeIdx = t % nodeCount;
+                affinityData[t].cpu = nodeCpus[nodeIdx][(t / nodeCount) % nodeCpuCounts[nodeIdx]];
+            }
+
+            RunPoolJob(pool, pool->threads, SetAffinityThread, affinityData, sizeof(ThreadAffinityData));
+        }
+
+        int rangeIdx = 0;
+        for (uint64_t threads = range->start; threads <= range->end; threads += range->step, rangeIdx++) {
+            if (split == 2 && threads < nodeCount) {
+                fprintf(stderr, "%lu threads can't cover %d nodes, skipping numa split\n", threads, nodeCount);
+                continue;
+            }
+
+            for (int store = 0; store < 2; store++) {
+                SetupCopySplit(copyData, threads, split, bytes, sliceOffsets, nodeCount);
+                for (uint64_t t = 0; t < threads; t++) {
+                    copyData[t].src = src;
+                    copyData[t].dst = dst;
+                    copyData[t].copyFunc = copyFuncs[store];
+                }
+
+                uint64_t elapsedNs = RunPoolJob(pool, threads, CopyThread, copyData, sizeof(CopyThreadData));
+                float bw = (double)bytes * COPY_PASSES / (double)elapsedNs;
+                results[(rangeIdx * splitCount + split) * 2 + store] = bw;
+                fprintf(stderr, "%lu threads, %s split, %s stores: %f GB/s\n", threads, copy_split_names[split], storeNames[store], bw);
+            }
+        }
+    }
+
+    printf("Threads");
+    for (int split = 0; split < splitCount; split++)
+        for (int store = 0; store < 2; store++) printf(",%s %s (GB/s)", copy_split_names[split], storeNames[store]);
+    printf("\n");
+
+    int rangeIdx = 0;
+    for (uint64_t threads = range->start; threads <= range->end; threads += range->step, rangeIdx++) {
+        printf("%lu", threads);
+        for (int i = 0; i < splitCount * 2; i++) printf(",%f", results[rangeIdx * splitCount * 2 + i]);
+        printf("\n");
+    }
+
+cleanup:
+    FreeTestArray((float *)src, srcMapped);
+    FreeTestArray((float *)dst, dstMapped);
+    for (int nodeIdx = 0; nodeIdx < nodeCount; nodeIdx++) free(nodeCpus[nodeIdx]);
+    free(nodeCpus);
+    free(nodeCpuCounts);
+    free(sliceOffsets);
+    free(nodes);
+    free(copyData);
+    free(affinityData);
+    free(results);
+}
+
+// instruction fetch test sizes are limited to this range, in KB
+#define INSTR_MIN_KB 16
+#define INSTR_MAX_KB (64 * 1024)
+
+typedef void (*InstrFunc)();
+
+typedef struct InstrFetchThreadData {
+    InstrFunc func;
+    uint64_t iterations;
+} InstrFetchThreadData;
+
+void *InstrFetchThread(void *param) {
+    InstrFetchThreadData *instrData = (InstrFetchThreadData *)param;
+    for (uint64_t iter = 0; iter < instrData->iterations; iter++) instrData->func();
+    return NULL;
+}
+
+/// <summary>
+/// Fills an executable region with straight-line nops ending in a ret. 8 byte nops on x86
+/// (0F 1F 84 00 00 00 00 00), and 4 byte nops on aarch64
+/// </summary>
+/// <returns>the region, callable as a function, or NULL on failure</returns>
+InstrFunc GenerateNopRegion(uint64_t bytes) {
+    char *region = (char *)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) return NULL;
+    if (page_mode == PAGES_THP) madvise(region, bytes, MADV_HUGEPAGE);
+#ifdef __x86_64
+    const unsigned char nop8[8] = { 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    for (uint64_t offset = 0; offset + 8 <= bytes - 8; offset += 8) memcpy(region + offset, nop8, 8);
+    memcpy(region + bytes - 8, nop8, 7);
+    region[bytes - 8] = 0xC3; // ret, padded out by the partial nop after it
+#else
+    uint32_t *insns = (uint32_t *)region;
+    for (uint64_t i = 0; i < bytes / 4 - 1; i++) insns[i] = 0xd503201f; // nop
+    insns[bytes / 4 - 1] = 0xd65f03c0; // ret
+#endif
+    if (mprotect(region, bytes, PROT_READ | PROT_EXEC) != 0) {
+        munmap(region, bytes);
+        return NULL;
+    }
+
+    __builtin___clear_cache(region, region + bytes);
+    return (InstrFunc)region;
+}
+
+/// <summary>
+/// Runs through nop regions of each test size between 16 KB and 64 MB from every thread,
+/// and reports instruction bytes fetched per second, summed across threads
+/// </summary>
+void RunInstructionFetchTest(BandwidthThreadPool *pool, uint64_t threads) {
+    InstrFetchThreadData *instrData = (InstrFetchThreadData *)malloc(threads * sizeof(InstrFetchThreadData));
+    printf("Region (KB),Instruction fetch (GB/s)\n");
+    for (int i = 0; i < test_size_count; i++) {
+        uint64_t sizeKb = test_sizes[i];
+        if (sizeKb < INSTR_MIN_KB || sizeKb > INSTR_MAX_KB) continue;
+
+        InstrFunc func = GenerateNopRegion(sizeKb * 1024);
+        if (func == NULL) {
+            fprintf(stderr, "Could not create a %lu KB executable region\n", sizeKb);
+            continue;
+        }
+
+        // instruction fetch is a lot slower than data reads once it's out of L1i
+        uint64_t iterations = GetIterationCount(sizeKb, threads) / 16;
+        if (iterations < 8) iterations = 8;
+        for (uint64_t t = 0; t < threads; t++) {
+            instrData[t].func = func;
+            instrData[t].iterations = iterations;
+        }
+
+        uint64_t elapsedNs = RunPoolJob(pool, threads, InstrFetchThread, instrData, sizeof(InstrFetchThreadData));
+        float bw = (double)iterations * sizeKb * 1024 * threads / (double)elapsedNs;
+        fprintf(stderr, "%lu KB: %f GB/s\n", sizeKb, bw);
+        printf("%lu,%f\n", sizeKb, bw);
+        fflush(stdout);
+        munmap((void *)func, sizeKb * 1024);
+    }
+
+    free(instrData);
+}
+#else
+void RunNumaMatrix(BandwidthThreadPool *pool, SweepRange *range, uint64_t sizeKb, int shared) {
+    fprintf(stderr, "NUMA tests are only supported on Linux\n");
+}
+
+void RunCoreToCoreTest(BandwidthThreadPool *pool, int cpuStride) {
+    fprintf(stderr, "Core to core tests are only supported on Linux\n");
+}
+
+void RunFileIoTest(const char *path, uint64_t fileSizeMb, uint32_t queueDepth) {
+    fprintf(stderr, "File I/O tests are only supported on Linux\n");
+}
+
+void RunCopyTest(BandwidthThreadPool *pool, SweepRange *range, uint64_t sizeMb) {
+    fprintf(stderr, "Copy tests are only supported on Linux\n");
+}
+
+void RunInstructionFetchTest(BandwidthThreadPool *pool, uint64_t threads) {
+    fprintf(stderr, "Instruction fetch tests are only supported on Linux\n");
+}
+#endif
+
+/// <summary>
+/// Given test size in KB, return a good iteration count
+/// </summary>
+/// <param name="testSize">test size in KB</param>
+/// <returns>Iterations per thread</returns>
+uint64_t GetIterationCount(uint64_t testSize, uint64_t threads)
+{
+    uint64_t gbToTransfer = 512;
+    if (testSize > 64) gbToTransfer = 64;
+    if (testSize > 512) gbToTransfer = 32;
+    if (testSize > 8192) gbToTransfer = 16;
+    uint64_t iterations = gbToTransfer * 1024 * 1024 / testSize;
+
+    if (iterations < 8) return 8; // set a minimum to reduce noise
+    else return iterations;
+}
+
+typedef struct FillTestArrayData {
+    float *arr;
+    uint64_t start;
+    uint64_t end;
+    uint64_t seed;
+    int cpu;              // CPU to fill from, or -1 to stay wherever the worker is
+} FillTestArrayData;
+
+// pool job to fill part of a test array, so pages get first touched by the thread that'll use them
+void *FillTestArrayThread(void *param) {
+    FillTestArrayData *fillData = (FillTestArrayData *)param;
+#ifdef __linux__
+    // pin just for the fill, then put the worker's old affinity back
+    cpu_set_t oldMask;
+    int pinned = fillData->cpu >= 0 && sched_getaffinity(0, sizeof(cpu_set_t), &oldMask) == 0;
+    if (pinned) {
+        ThreadAffinityData affinityData = { fillData->cpu };
+        SetAffinityThread(&affinityData);
+    }
+#endif
+    for (uint64_t arr_idx = fillData->start; arr_idx < fillData->end; arr_idx++) {
+        fillData->arr[arr_idx] = arr_idx + fillData->seed + 0.5f;
+    }
+
+#ifdef __linux__
+    if (pinned) sched_setaffinity(0, sizeof(cpu_set_t), &oldMask);
+#endif
+    return NULL;
+}
+
+/// <summary>
+/// Allocates and fills arrays big enough for any test up to sizeKb. In private mode, array i is
+/// only read when there are at least i + 1 threads, so it's sized for max(minThreads, i + 1).
+/// Pool workers fill the arrays in parallel. Private arrays are filled by the worker that reads
+/// them. A shared array is split evenly across all workers, and without a NUMA policy the workers
+/// are spread over every online CPU while filling, so first touch spreads its pages across nodes
+/// </summary>
+/// <param name="memNode">NUMA node to place memory on, or NUMA_NODE_ANY/NUMA_NODE_INTERLEAVE</param>
+/// <returns>1 on success, 0 if allocation failed</returns>
+int AllocateTestBuffers(BandwidthThreadPool *pool, BandwidthTestBuffers *buffers, uint64_t sizeKb, uint64_t minThreads, uint64_t maxThreads, int shared, int memNode) {
+    buffers->shared = shared;
+    buffers->memNode = memNode;
+    buffers->count = shared ? 1 : maxThreads;
+    buffers->arrs = (float **)calloc(buffers->count, sizeof(float *));
+    buffers->elements = (uint64_t *)calloc(buffers->count, sizeof(uint64_t));
+    buffers->mappedBytes = (uint64_t *)calloc(buffers->count, sizeof(uint64_t));
+    if (buffers->arrs == NULL || buffers->elements == NULL || buffers->mappedBytes == NULL) {
+        fprintf(stderr, "Could not allocate memory\n");
+        return 0;
+    }
+
+    for (uint64_t i = 0; i < buffers->count; i++) {
+        uint64_t arrThreads = minThreads > i + 1 ? minThreads : i + 1;
+        buffers->elements[i] = sizeKb * 1024 / sizeof(float);
+        if (!shared) buffers->elements[i] = (uint64_t)ceil(((double)sizeKb * 1024 / sizeof(float)) / (double)arrThreads);
+        buffers->arrs[i] = AllocateTestArray(buffers->elements[i] * sizeof(float), memNode, buffers->mappedBytes + i);
+        if (buffers->arrs[i] == NULL) {
+            fprintf(stderr, "Could not allocate memory for thread %ld\n", i);
+            FreeTestBuffers(buffers);
+            return 0;
+        }
+    }
+
+    uint64_t fillThreads = shared ? pool->threads : buffers->count;
+    uint64_t sliceElements = (buffers->elements[0] / fillThreads + 1023) & ~1023ULL; // 4 KB page granularity
+    FillTestArrayData *fillData = (FillTestArrayData *)malloc(fillThreads * sizeof(FillTestArrayData));
+    int *fillCpus = NULL, fillCpuCount = 0;
+#ifdef __linux__
+    if (shared && memNode == NUMA_NODE_ANY) fillCpus = ReadSysfsList("/sys/devices/system/cpu/online", &fillCpuCount);
+#endif
+    for (uint64_t i = 0; i < fillThreads; i++) {
+        fillData[i].cpu = fillCpuCount > 0 ? fillCpus[i * fillCpuCount / fillThreads] : -1;
+        uint64_t arrElements = buffers->elements[shared ? 0 : i];
+        fillData[i].arr = shared ? buffers->arrs[0] : buffers->arrs[i];
+        fillData[i].seed = shared ? 0 : i;
+        fillData[i].start = shared ? i * sliceElements : 0;
+        fillData[i].end = shared ? (i + 1) * sliceElements : arrElements;
+        if (fillData[i].start > arrElements) fillData[i].start = arrElements;
+        if (fillData[i].end > arrElements) fillData[i].end = arrElements;
+    }
+
+    RunPoolJob(pool, fillThreads, FillTestArrayThread, fillData, sizeof(FillTestArrayData));
+    free(fillCpus);
+    free(fillData);
+    ReportPageBacking(buffers);
+    return 1;
+}
+
+void FreeTestBuffers(BandwidthTestBuffers *buffers) {
+    for (uint64_t i = 0; i < buffers->count; i++) {
+        if (buffers->arrs != NULL && buffers->mappedBytes != NULL)
+            FreeTestArray(buffers->arrs[i], buffers->mappedBytes[i]);
+    }
+
+    free(buffers->arrs);
+    free(buffers->elements);
+    free(buffers->mappedBytes);
+    buffers->arrs = NULL;
+    buffers->elements = NULL;
+    buffers->mappedBytes = NULL;
+    buffers->count = 0;
+}
+
+/// <summary>
+/// Allocates a 64B aligned test array. With default pages and no NUMA placement it comes
+/// from aligned_alloc. Otherwise it's mmap-ed with the requested page size, and has its
+/// NUMA policy set before anything touches it
+/// </summary>
+/// <param name="mappedBytes">set to the mmap-ed length, or 0 if aligned_alloc was used</param>
+/// <returns>array, or NULL on failure</returns>
+float *AllocateTestArray(uint64_t bytes, int memNode, uint64_t *mappedBytes) {
+    *mappedBytes = 0;
+    if (memNode == NUMA_NODE_ANY && page_mode == PAGES_DEFAULT) return (float *)aligned_alloc(64, bytes);
+
+#ifdef __linux__
+    char *arr = NULL;
+    uint64_t hugePageSize = 2 * 1024 * 1024;
+    if (page_mode == PAGES_2M || page_mode == PAGES_1G) {
+        int hugeFlag = page_mode == PAGES_1G ? MAP_HUGE_1GB : MAP_HUGE_2MB;
+        if (page_mode == PAGES_1G) hugePageSize = 1024 * 1024 * 1024;
+        *mappedBytes = (bytes + hugePageSize - 1) & ~(hugePageSize - 1);
+        arr = (char *)mmap(NULL, *mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | hugeFlag, -1, 0);
+        if (arr == MAP_FAILED) {
+            fprintf(stderr, "Could not get %lu KB of %lu KB pages, check /sys/kernel/mm/hugepages. Using 4 KB pages\n",
+                *mappedBytes / 1024, hugePageSize / 1024);
+            arr = NULL;
+        }
+    }
+
+    if (arr == NULL) {
+        // for THP, map a bit extra and trim so the array starts on a 2 MB boundary
+        uint64_t alignment = page_mode == PAGES_THP ? hugePageSize : 4096;
+        uint64_t rounded = (bytes + alignment - 1) & ~(alignment - 1);
+        char *base = (char *)mmap(NULL, rounded + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) return NULL;
+        arr = (char *)(((uintptr_t)base + alignment - 1) & ~(alignment - 1));
+        if (arr != base) munmap(base, arr - base);
+        munmap(arr + rounded, base + rounded + alignment - arr - rounded);
+        *mappedBytes = rounded;
+        madvise(arr, rounded, page_mode == PAGES_THP ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+    }
+
+    if (memNode != NUMA_NODE_ANY) {
+        int nodeCount;
+        unsigned long nodeMask[16] = { 0 };
+        unsigned long maxNode = sizeof(nodeMask) * 8;
+        int *nodes = ReadSysfsList("/sys/devices/system/node/online", &nodeCount);
+        if (nodes == NULL) {
+            munmap(arr, *mappedBytes);
+            return NULL;
+        }
+
+        for (int i = 0; i < nodeCount; i++) {
+            if (memNode == NUMA_NODE_INTERLEAVE || nodes[i] == memNode)
+                nodeMask[nodes[i] / (sizeof(unsigned long) * 8)] |= 1UL << (nodes[i] % (sizeof(unsigned long) * 8));
+        }
+
+        free(nodes);
+        int mode = memNode == NUMA_NODE_INTERLEAVE ? MPOL_INTERLEAVE : MPOL_BIND;
+        if (syscall(SYS_mbind, arr, *mappedBytes, mode, nodeMask, maxNode, MPOL_MF_STRICT) != 0) {
+            fprintf(stderr, "mbind to node %d failed\n", memNode);
+            munmap(arr, *mappedBytes);
+            return NULL;
+        }
+    }
+
+    return (float *)arr;
+#else
+    fprintf(stderr, "NUMA placement and page size selection are only supported on Linux\n");
+    return NULL;
+#endif
+}
+
+void FreeTestArray(float *arr, uint64_t mappedBytes) {
+    if (arr == NULL) return;
+#ifdef __linux__
+    if (mappedBytes != 0) {
+        munmap(arr, mappedBytes);
+        return;
+    }
+#endif
+    free(arr);
+}
+
+/// <summary>
+/// Prints what page sizes actually back the test arrays, going by /proc/self/smaps.
+/// hugetlbfs mappings show up with a bigger KernelPageSize, while THP shows up as AnonHugePages
+/// </summary>
+void ReportPageBacking(BandwidthTestBuffers *buffers) {
+#ifdef __linux__
+    char line[512];
+    uint64_t mapStart, mapEnd, value;
+    uint64_t rssKb = 0, thpKb = 0, kernelPageKb = 0;
+    int inTestArray = 0;
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (smaps == NULL) return;
+
+    while (fgets(line, sizeof(line), smaps) != NULL) {
+        if (sscanf(line, "%lx-%lx ", &mapStart, &mapEnd) == 2) {
+            inTestArray = 0;
+            for (uint64_t i = 0; i < buffers->count; i++) {
+                uintptr_t arrStart = (uintptr_t)buffers->arrs[i];
+                if (arrStart < mapEnd && arrStart + buffers->elements[i] * sizeof(float) > mapStart) inTestArray = 1;
+            }
+        } else if (inTestArray) {
+            if (sscanf(line, "Rss: %lu kB", &value) == 1) rssKb += value;
+            else if (sscanf(line, "Private_Hugetlb: %lu kB", &value) == 1) rssKb += value; // hugetlbfs isn't counted in Rss
+            else if (sscanf(line, "AnonHugePages: %lu kB", &value) == 1) thpKb += value;
+            else if (sscanf(line, "KernelPageSize: %lu kB", &value) == 1 && value > kernelPageKb) kernelPageKb = value;
+        }
+    }
+
+    fclose(smaps);
+    fprintf(stderr, "Test arrays: %lu KB resident, %lu KB kernel pages, %lu KB in transparent huge pages\n", rssKb, kernelPageKb, thpKb);
+#endif
+}
+
+/// <summary>
+/// Runs one bandwidth measurement on already filled buffers
+/// </summary>
+/// <param name="sampleIntervalUs">if not 0, also print a bandwidth time series sampled at this interval</param>
+/// <returns>bandwidth in GB/s</returns>
+float MeasureBw(BandwidthThreadPool *pool, BandwidthTestBuffers *buffers, uint64_t sizeKb, uint64_t iterations, uint64_t threads, uint64_t sampleIntervalUs) {
+    float bw = 0;
+    int shared = buffers->shared;
+    uint64_t elements = sizeKb * 1024 / sizeof(float);
+
+    if (!shared && sizeKb < threads) {
+        fprintf(stderr, "Too many threads for this test size\n");
+        return 0;
+    }
+
+    if (threads > pool->threads || (!shared && threads > buffers->count)) {
+        fprintf(stderr, "Not enough worker threads or arrays for %lu threads\n", threads);
+        return 0;
+    }
+
+    // make sure this is divisble by 512 bytes, since the unrolled asm loop depends on that
+    // it's hard enough to get close to theoretical L1D BW as is, so we don't want additional cmovs or branches
+    // in the hot loop
+    uint64_t private_elements = (uint64_t)ceil(((double)sizeKb * 1024 / sizeof(float)) / (double)threads);
+    //fprintf(stderr, "Actual data: %lu KB\n", private_elements * 4 * threads / 1024);
+    if (!shared) elements = private_elements;
+    if (elements > buffers->elements[0] || (!shared && elements > buffers->elements[threads - 1])) {
+        fprintf(stderr, "%lu KB doesn't fit in the allocated test arrays\n", sizeKb);
+        return 0;
+    }
+
+    struct BandwidthTestThreadData* threadData = (struct BandwidthTestThreadData*)malloc(threads * sizeof(struct BandwidthTestThreadData));
+    for (uint64_t i = 0; i < threads; i++) {
+        if (shared) 
+        {
+            threadData[i].arr = buffers->arrs[0];
+            threadData[i].iterations = iterations;
+        }
+        else
+        {
+            threadData[i].arr = buffers->arrs[i];
+            threadData[i].iterations = iterations * threads;
+        }
+
+        threadData[i].arr_length = elements;
+        threadData[i].bw = 0;
+        threadData[i].start = 0;
+        threadData[i].progress = NULL;
+        if (elements > 8192 * 1024) threadData[i].start = 4096 * i; // must be multiple of 128 because of unrolling
+    }
+
+    BandwidthMonitorData monitor;
+    pthread_t monitorThread;
+    if (sampleIntervalUs != 0) {
+        memset(&monitor, 0, sizeof(monitor));
+        monitor.threads = threads;
+        monitor.intervalUs = sampleIntervalUs;
+        monitor.counters = (BandwidthProgressCounter *)aligned_alloc(64, threads * sizeof(BandwidthProgressCounter));
+        memset(monitor.counters, 0, threads * sizeof(BandwidthProgressCounter));
+        for (uint64_t i = 0; i < threads; i++) threadData[i].progress = &(monitor.counters[i].bytes);
+        pthread_create(&monitorThread, NULL, BandwidthMonitorThread, &monitor);
+    }
+
+    uint64_t time_diff_ns = RunPoolJob(pool, threads, ReadBandwidthTestThread, threadData, sizeof(struct BandwidthTestThreadData));
+    if (sampleIntervalUs != 0) {
+        monitor.done = 1;
+        pthread_join(monitorThread, NULL);
+        PrintBandwidthSamples(&monitor, sizeKb);
+        free(monitor.counters);
+        free(monitor.sampleTimesNs);
+        free(monitor.sampleBytes);
+    }
+
+    double gbTransferred = iterations * sizeof(float) * elements * threads / (double)1e9;
+    bw = gbTransferred * 1e9 / (double)time_diff_ns;
+    if (!shared) bw = bw * threads; // iteration count is divided by thread count if in thread private mode
+    //printf("%f GB, %lu ns\n", gbTransferred, time_diff_ns);
+
+    free(threadData);
+    return bw;
+}
+
+/// <summary>
+/// Samples every thread's pass counter at a fixed interval until the test finishes
+/// </summary>
+void *BandwidthMonitorThread(void *param) {
+    BandwidthMonitorData *monitor = (BandwidthMonitorData *)param;
+    struct timespec startTs, nextTs, nowTs;
+    clock_gettime(CLOCK_MONOTONIC, &startTs);
+    nextTs = startTs;
+    while (1) {
+        int lastSample = monitor->done;
+        if (monitor->sampleCount == monitor->sampleCapacity) {
+            monitor->sampleCapacity = monitor->sampleCapacity ? monitor->sampleCapacity * 2 : 4096;
+            monitor->sampleTimesNs = (uint64_t *)realloc(monitor->sampleTimesNs, monitor->sampleCapacity * sizeof(uint64_t));
+            monitor->sampleBytes = (uint64_t *)realloc(monitor->sampleBytes, monitor->sampleCapacity * monitor->threads * sizeof(uint64_t));
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &nowTs);
+        monitor->sampleTimesNs[monitor->sampleCount] = 1000000000ULL * (nowTs.tv_sec - startTs.tv_sec) + (nowTs.tv_nsec - startTs.tv_nsec);
+        for (uint64_t i = 0; i < monitor->threads; i++)
+            monitor->sampleBytes[monitor->sampleCount * monitor->threads + i] = __atomic_load_n(&(monitor->counters[i].bytes), __ATOMIC_RELAXED);
+        monitor->sampleCount++;
+        if (lastSample) break;
+
+        nextTs.tv_nsec += monitor->intervalUs * 1000;
+        nextTs.tv_sec += nextTs.tv_nsec / 1000000000;
+        nextTs.tv_nsec %= 1000000000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &nextTs, NULL);
+    }
+
+    return NULL;
+}
+
+/// <summary>
+/// Prints per-interval bandwidth for each thread and in total, one row per sample
+/// </summary>
+void PrintBandwidthSamples(BandwidthMonitorData *monitor, uint64_t sizeKb) {
+    for (uint64_t sampleIdx = 1; sampleIdx < monitor->sampleCount; sampleIdx++) {
+        uint64_t *bytes = monitor->sampleBytes + sampleIdx * monitor->threads;
+        uint64_t *lastBytes = bytes - monitor->threads;
+        double intervalNs = (double)(monitor->sampleTimesNs[sampleIdx] - monitor->sampleTimesNs[sampleIdx - 1]);
+        double totalBw = 0;
+        for (uint64_t i = 0; i < monitor->threads; i++) totalBw += (bytes[i] - lastBytes[i]) / intervalNs;
+
+        printf("%lu,%f,%f", sizeKb, monitor->sampleTimesNs[sampleIdx] / 1e6, totalBw);
+        for (uint64_t i = 0; i < monitor->threads; i++) printf(",%f", (bytes[i] - lastBytes[i]) / intervalNs);
+        printf("\n");
+    }
+}
+
+void *BandwidthPoolWorkerThread(void *param) {
+    BandwidthPoolWorker *worker = (BandwidthPoolWorker *)param;
+    BandwidthThreadPool *pool = worker->pool;
+    while (1) {
+        pthread_barrier_wait(&pool->startBarrier);
+        if (pool->quit) break;
+        if (worker->index < pool->active) pool->job(pool->jobData + worker->index * pool->jobDataStride);
+        pthread_barrier_wait(&pool->endBarrier);
+    }
+
+    return NULL;
+}
+
+/// <summary>
+/// Starts worker threads. Barriers include the main thread, which times jobs
+/// </summary>
+/// <returns>1 on success, 0 on failure</returns>
+int CreateThreadPool(BandwidthThreadPool *pool, uint64_t threads) {
+    pool->threads = threads;
+    pool->active = 0;
+    pool->quit = 0;
+    pool->handles = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    pool->workers = (BandwidthPoolWorker *)malloc(threads * sizeof(BandwidthPoolWorker));
+    if (pool->handles == NULL || pool->workers == NULL) {
+        fprintf(stderr, "Could not allocate thread pool\n");
+        return 0;
+    }
+
+    pthread_barrier_init(&pool->startBarrier, NULL, threads + 1);
+    pthread_barrier_init(&pool->endBarrier, NULL, threads + 1);
+    for (uint64_t i = 0; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(pool->handles + i, NULL, BandwidthPoolWorkerThread, (void *)(pool->workers + i)) != 0) {
+            fprintf(stderr, "Could not create thread %lu\n", i);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/// <summary>
+/// Runs job on the first 'active' workers and waits for all of them
+/// </summary>
+/// <returns>elapsed time in ns</returns>
+uint64_t RunPoolJob(BandwidthThreadPool *pool, uint64_t active, void *(*job)(void *), void *jobData, size_t jobDataStride) {
+    struct timespec startTs, endTs;
+    pool->active = active;
+    pool->job = job;
+    pool->jobData = (char *)jobData;
+    pool->jobDataStride = jobDataStride;
+
+    clock_gettime(CLOCK_MONOTONIC, &startTs);
+    pthread_barrier_wait(&pool->startBarrier);
+    pthread_barrier_wait(&pool->endBarrier);
+    clock_gettime(CLOCK_MONOTONIC, &endTs);
+    return 1000000000ULL * (endTs.tv_sec - startTs.tv_sec) + (endTs.tv_nsec - startTs.tv_nsec);
+}
+
+void DestroyThreadPool(BandwidthThreadPool *pool) {
+    pool->quit = 1;
+    pthread_barrier_wait(&pool->startBarrier);
+    for (uint64_t i = 0; i < pool->threads; i++) pthread_join(pool->handles[i], NULL);
+    pthread_barrier_destroy(&pool->startBarrier);
+    pthread_barrier_destroy(&pool->endBarrier);
+    free(pool->handles);
+    free(pool->workers);
+}
+
+#ifdef __x86_64
+__attribute((ms_abi)) float scalar_read(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) {
+#else
+float scalar_read(float* arr, uint64_t arr_length, uint64_t iterations, uint64_t start) {
+#endif
+    float sum = 0;
+    if (start + 16 >= arr_length) return 0;
+
+    uint64_t iter_idx = 0, i = start;
+    float s1 = 0, s2 = 1, s3 = 0, s4 = 1, s5 = 0, s6 = 1, s7 = 0, s8 = 1;
+    while (iter_idx < iterations) {
+        s1 += arr[i];
+        s2 *= arr[i + 1];
+        s3 += arr[i + 2];
+        s4 *= arr[i + 3];
+        s5 += arr[i + 4];
+        s6 *= arr[i + 5];
+        s7 += arr[i + 6];
+        s8 *= arr[i + 7];
+        i += 8;
+        if (i + 7 >= arr_length) i = 0;
+        if (i == start) iter_idx++;
+    }
+        
+    sum += s1 + s2 + s3 + s4 + s5 + s6 + s7 + s8;
+
+    return sum;
+}
+
+void *ReadBandwidthTestThread(void *param) {
+    BandwidthTestThreadData* bwTestData = (BandwidthTestThreadData*)param;
+    float sum = 0;
+    if (bwTestData->progress == NULL) {
+        sum = bw_func(bwTestData->arr, bwTestData->arr_length, bwTestData->iterations, bwTestData->start);
+    } else if (bwTestData->arr_length <= SAMPLED_CHUNK_ELEMENTS) {
+        // report progress after each pass. tiny arrays do a batch of passes per call, to keep call overhead
+        // from showing up in the result. a 1 MB batch is still well under a ms
+        uint64_t batch = SAMPLED_CHUNK_ELEMENTS / bwTestData->arr_length;
+        for (uint64_t done = 0; done < bwTestData->iterations; done += batch) {
+            if (batch > bwTestData->iterations - done) batch = bwTestData->iterations - done;
+            sum += bw_func(bwTestData->arr, bwTestData->arr_length, batch, bwTestData->start);
+            __atomic_store_n(bwTestData->progress, *(bwTestData->progress) + batch * bwTestData->arr_length * sizeof(float), __ATOMIC_RELAXED);
+        }
+    } else {
+        // a pass over a big array can take longer than the sampling interval, so go through it
+        // in chunks, starting from the same place the unsampled test would
+        uint64_t pos = bwTestData->start;
+        for (uint64_t iter_idx = 0; iter_idx < bwTestData->iterations; iter_idx++) {
+            uint64_t remaining = bwTestData->arr_length;
+            while (remaining > 0) {
+                uint64_t chunk = SAMPLED_CHUNK_ELEMENTS;
+                if (chunk > bwTestData->arr_length - pos) chunk = bwTestData->arr_length - pos;
+                if (chunk > remaining) chunk = remaining;
+                sum += bw_func(bwTestData->arr + pos, chunk, 1, 0);
+                __atomic_store_n(bwTestData->progress, *(bwTestData->progress) + chunk * sizeof(float), __ATOMIC_RELAXED);
+                remaining -= chunk;
+                pos += chunk;
+                if (pos == bwTestData->arr_length) pos = 0;
+            }
+        }
+    }
+
     if (sum == 0) printf("woohoo\n");
-    pthread_exit(NULL);
+    return NULL;
 }
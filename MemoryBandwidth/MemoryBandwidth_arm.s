@@ -2,6 +2,10 @@
 .text
 
 .global asm_read
+.global dc_cvac_lines
+.global dc_civac_lines
+.global copy_regular
+.global copy_nt
 
 /* x0 = ptr to array (was rcx)
  * x1 = arr length (was rdx)
@@ -75,3 +79,103 @@ asm_read_pass_loop:
   ldp x14, x15, [sp, #0x10]
   add sp, sp, #0x30
   ret
+
+/* Same as asm_read, but with a prfm for each 64B line, prefetch_distance
+ * bytes ahead of the loads. prefetch_distance is a global set from C.
+ * x16 and x17 are scratch, so they hold the distance for each line
+ */
+.global asm_read_pfl1keep
+.global asm_read_pfl2strm
+
+.macro prefetch_read_block op
+  prfm \op, [x15, x16]
+  prfm \op, [x15, x17]
+  ldr q16, [x15]
+  ldr q17, [x15, 16]
+  ldr q18, [x15, 32]
+  ldr q19, [x15, 48]
+  ldr q20, [x15, 64]
+  ldr q21, [x15, 80]
+  ldr q22, [x15, 96]
+  ldr q22, [x15, 112]
+  add x14, x14, 32
+.endm
+
+.macro asm_read_prefetch name, op
+\name:
+  sub sp, sp, #0x30
+  stp x14, x15, [sp, #0x10]
+  stp x12, x13, [sp, #0x20]
+  adrp x16, prefetch_distance
+  ldr x16, [x16, #:lo12:prefetch_distance]
+  add x17, x16, 64
+  sub x1, x1, 128 /* last iteration: rsi == rdx. rsi > rdx = break */
+  mov x14, x3     /* set x14 = index into array to start location (x3) */
+  eor x13, x13, x13 /* x13 = 0 (for comparison) */
+\name\()_pass_loop:
+  lsl x12, x14, 2  /* x12 = x14 * 4, because float is 4B */
+  add x15, x0, x12 /* ptr (x15) to next element = x0 (base) + x12 (index *4) */
+  prefetch_read_block \op
+  lsl x12, x14, 2
+  add x15, x0, x12
+  prefetch_read_block \op
+  lsl x12, x14, 2
+  add x15, x0, x12
+  prefetch_read_block \op
+  lsl x12, x14, 2
+  add x15, x0, x12
+  prefetch_read_block \op
+  cmp x1, x14 /* if x1 (len - 128) - x14 < 0, loop back around */
+  csel x14, x13, x14, LT
+  cmp x14, x3
+  b.ne \name\()_pass_loop /* skip iteration decrement if we're not back to start */
+  sub x2, x2, 1
+  cbnz x2, \name\()_pass_loop
+  ins v0.4s[0], v16.4s[0]
+  ldp x12, x13, [sp, #0x20]
+  ldp x14, x15, [sp, #0x10]
+  add sp, sp, #0x30
+  ret
+.endm
+
+asm_read_prefetch asm_read_pfl1keep, pldl1keep
+asm_read_prefetch asm_read_pfl2strm, pldl2strm
+
+/* x0 = ptr, x1 = bytes. runs the dc op on every 64B line in the range to the point of
+ * coherency, then waits for it to complete. Linux lets EL0 use dc cvac and dc civac
+ */
+.macro dc_lines name, op
+\name:
+  add x1, x0, x1
+\name\()_loop:
+  dc \op, x0
+  add x0, x0, 64
+  cmp x0, x1
+  b.lo \name\()_loop
+  dsb sy
+  ret
+.endm
+
+dc_lines dc_cvac_lines, cvac
+dc_lines dc_civac_lines, civac
+
+/* x0 = dst, x1 = src, x2 = bytes, a nonzero multiple of 64
+ * copies with regular stores, or stnp which hints that the data won't be reused soon
+ */
+.macro copy_kernel name, store
+\name:
+  add x2, x1, x2
+\name\()_loop:
+  ldp q0, q1, [x1]
+  ldp q2, q3, [x1, 32]
+  \store q0, q1, [x0]
+  \store q2, q3, [x0, 32]
+  add x0, x0, 64
+  add x1, x1, 64
+  cmp x1, x2
+  b.lo \name\()_loop
+  ret
+.endm
+
+copy_kernel copy_regular, stp
+copy_kernel copy_nt, stnp
@@ -3,6 +3,11 @@
 .global asm_read
 .global sse_read
 .global avx512_read
+.global clflush_lines
+.global clflushopt_lines
+.global clwb_lines
+.global copy_regular
+.global copy_nt
 
 asm_read:
   push %rsi
@@ -158,3 +163,175 @@ avx512_test_iteration_count:
   pop %rdi 
   pop %rsi 
   ret  
+
+/* Same as asm_read and avx512_read, but with a software prefetch for each
+ * 64B line, prefetch_distance bytes ahead of the loads. prefetch_distance
+ * is a global set from C. Prefetching past the end of the array is fine
+ * because prefetches don't fault
+ */
+.global asm_read_pft0
+.global asm_read_pft2
+.global asm_read_pfnta
+.global avx512_read_pft0
+.global avx512_read_pft2
+.global avx512_read_pfnta
+
+.macro prefetch_block pf
+  \pf (%rdi,%r10)
+  \pf 64(%rdi,%r10)
+  \pf 128(%rdi,%r10)
+  \pf 192(%rdi,%r10)
+.endm
+
+.macro avx_read_prefetch name, pf
+\name:
+  push %rsi
+  push %rdi
+  push %rbx
+  push %r15
+  push %r14
+  mov prefetch_distance(%rip), %r10
+  mov $256, %r15 /* load in blocks of 256 bytes */
+  sub $128, %rdx /* last iteration: rsi == rdx. rsi > rdx = break */
+  mov %r9, %rsi  /* assume we're passed in an aligned start location O.o */
+  xor %rbx, %rbx
+  lea (%rcx,%rsi,4), %rdi
+  mov %rdi, %r14
+\name\()_pass_loop:
+  prefetch_block \pf
+  vmovaps (%rdi), %ymm0
+  vmovaps 32(%rdi), %ymm1
+  vmovaps 64(%rdi), %ymm2
+  vmovaps 96(%rdi), %ymm3
+  vmovaps 128(%rdi), %ymm0
+  vmovaps 160(%rdi), %ymm1
+  vmovaps 192(%rdi), %ymm2
+  vmovaps 224(%rdi), %ymm3
+  add $64, %rsi
+  add %r15, %rdi
+  prefetch_block \pf
+  vmovaps (%rdi), %ymm0
+  vmovaps 32(%rdi), %ymm1
+  vmovaps 64(%rdi), %ymm2
+  vmovaps 96(%rdi), %ymm3
+  vmovaps 128(%rdi), %ymm0
+  vmovaps 160(%rdi), %ymm1
+  vmovaps 192(%rdi), %ymm2
+  vmovaps 224(%rdi), %ymm3
+  add $64, %rsi
+  add %r15, %rdi
+  cmp %rsi, %rdx
+  jge \name\()_iteration_count
+  mov %rbx, %rsi
+  lea (%rcx,%rsi,4), %rdi /* back to start */
+\name\()_iteration_count:
+  cmp %rsi, %r9
+  jnz \name\()_pass_loop /* skip iteration decrement if we're not back to start */
+  dec %r8
+  jnz \name\()_pass_loop
+  pop %r14
+  pop %r15
+  pop %rbx
+  pop %rdi
+  pop %rsi
+  ret
+.endm
+
+.macro avx512_read_prefetch name, pf
+\name:
+  push %rsi
+  push %rdi
+  push %rbx
+  push %r15
+  push %r14
+  mov prefetch_distance(%rip), %r10
+  mov $256, %r15 /* load in blocks of 256 bytes */
+  sub $128, %rdx /* last iteration: rsi == rdx. rsi > rdx = break */
+  mov %r9, %rsi  /* assume we're passed in an aligned start location O.o */
+  xor %rbx, %rbx
+  lea (%rcx,%rsi,4), %rdi
+  mov %rdi, %r14
+\name\()_pass_loop:
+  prefetch_block \pf
+  vmovaps (%rdi), %zmm0
+  vmovaps 64(%rdi), %zmm1
+  vmovaps 128(%rdi), %zmm2
+  vmovaps 192(%rdi), %zmm3
+  add $64, %rsi
+  add %r15, %rdi
+  prefetch_block \pf
+  vmovaps (%rdi), %zmm0
+  vmovaps 64(%rdi), %zmm1
+  vmovaps 128(%rdi), %zmm2
+  vmovaps 192(%rdi), %zmm3
+  add $64, %rsi
+  add %r15, %rdi
+  cmp %rsi, %rdx
+  jge \name\()_iteration_count
+  mov %rbx, %rsi
+  lea (%rcx,%rsi,4), %rdi /* back to start */
+\name\()_iteration_count:
+  cmp %rsi, %r9
+  jnz \name\()_pass_loop /* skip iteration decrement if we're not back to start */
+  dec %r8
+  jnz \name\()_pass_loop
+  pop %r14
+  pop %r15
+  pop %rbx
+  pop %rdi
+  pop %rsi
+  ret
+.endm
+
+avx_read_prefetch asm_read_pft0, prefetcht0
+avx_read_prefetch asm_read_pft2, prefetcht2
+avx_read_prefetch asm_read_pfnta, prefetchnta
+avx512_read_prefetch avx512_read_pft0, prefetcht0
+avx512_read_prefetch avx512_read_pft2, prefetcht2
+avx512_read_prefetch avx512_read_pfnta, prefetchnta
+
+/* rcx = ptr, rdx = bytes. runs the cache maintenance instruction on every 64B line in the range,
+ * then waits for it to finish so nothing is still in flight when the caller starts timing
+ */
+.macro flush_lines name, insn, fence
+\name:
+  add %rcx, %rdx
+\name\()_loop:
+  \insn (%rcx)
+  add $64, %rcx
+  cmp %rdx, %rcx
+  jb \name\()_loop
+  \fence
+  ret
+.endm
+
+flush_lines clflush_lines, clflush, mfence
+flush_lines clflushopt_lines, clflushopt, sfence
+flush_lines clwb_lines, clwb, sfence
+
+/* rcx = dst, rdx = src, r8 = bytes, a nonzero multiple of 128. both 32B aligned
+ * copies with regular or non-temporal stores. the sfence makes NT stores globally visible before returning
+ */
+.macro copy_kernel name, store
+\name:
+  add %rdx, %r8
+\name\()_loop:
+  vmovaps (%rdx), %ymm0
+  vmovaps 32(%rdx), %ymm1
+  vmovaps 64(%rdx), %ymm2
+  vmovaps 96(%rdx), %ymm3
+  \store %ymm0, (%rcx)
+  \store %ymm1, 32(%rcx)
+  \store %ymm2, 64(%rcx)
+  \store %ymm3, 96(%rcx)
+  add $128, %rdx
+  add $128, %rcx
+  cmp %r8, %rdx
+  jb \name\()_loop
+  sfence
+  vzeroupper
+  ret
+.endm
+
+copy_kernel copy_regular, vmovaps
+copy_kernel copy_nt, vmovntps